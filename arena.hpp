@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// an arena is a bump allocator for objects which all die together
+//
+// objects are placed contiguously in large blocks and are destroyed,
+// along with the blocks, when the arena is. objects with nontrivial
+// destructors are recorded as they are made so that they can be
+// destroyed in one pass without chasing pointers between them
+class arena
+{
+  public:
+    explicit arena(std::size_t block_size = 64 << 10)
+      : block_size_(block_size),
+        position_(nullptr),
+        end_(nullptr),
+        finalizers_(nullptr),
+        object_count_(0),
+        bytes_used_(0)
+    {}
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena()
+    {
+      destroy_objects();
+    }
+
+    // destroys every object made so far, and makes the next ones in the first block again
+    // the other blocks are freed, so that one large batch of objects doesn't keep its memory
+    void reset()
+    {
+      destroy_objects();
+
+      if(!blocks_.empty())
+      {
+        blocks_.erase(blocks_.begin() + 1, blocks_.end());
+        position_ = blocks_.front().first.get();
+        end_ = position_ + blocks_.front().second;
+      }
+
+      object_count_ = 0;
+      bytes_used_ = 0;
+    }
+
+    template<class T, class... Args>
+    T* make(Args&&... args)
+    {
+      T* result = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+      if constexpr(!std::is_trivially_destructible_v<T>)
+      {
+        // record the object so we can destroy it later
+        finalizers_ = new(allocate(sizeof(finalizer), alignof(finalizer))) finalizer{
+          [](void* object)
+          {
+            static_cast<T*>(object)->~T();
+          },
+          result,
+          finalizers_
+        };
+      }
+
+      ++object_count_;
+      return result;
+    }
+
+    // the number of objects made in this arena
+    std::size_t object_count() const
+    {
+      return object_count_;
+    }
+
+    // the number of bytes handed out by this arena
+    std::size_t bytes_used() const
+    {
+      return bytes_used_;
+    }
+
+    // the number of bytes this arena has allocated from the system
+    std::size_t bytes_reserved() const
+    {
+      std::size_t result = 0;
+      for(const auto& b : blocks_)
+      {
+        result += b.second;
+      }
+
+      return result;
+    }
+
+    // the arena in which the current thread makes new objects
+    static arena* current()
+    {
+      return current_;
+    }
+
+    // makes an arena current for the lifetime of a scope
+    class scope
+    {
+      public:
+        explicit scope(arena& a)
+          : previous_(current_)
+        {
+          current_ = &a;
+        }
+
+        scope(const scope&) = delete;
+
+        ~scope()
+        {
+          current_ = previous_;
+        }
+
+      private:
+        arena* previous_;
+    };
+
+  private:
+    struct finalizer
+    {
+      void (*destroy)(void*);
+      void* object;
+      finalizer* next;
+    };
+
+    void destroy_objects()
+    {
+      for(finalizer* f = finalizers_; f; f = f->next)
+      {
+        f->destroy(f->object);
+      }
+
+      finalizers_ = nullptr;
+    }
+
+    void* allocate(std::size_t size, std::size_t alignment)
+    {
+      std::size_t padding = -reinterpret_cast<std::uintptr_t>(position_) & (alignment - 1);
+
+      if(static_cast<std::size_t>(end_ - position_) < padding + size)
+      {
+        // start a new block large enough for this allocation
+        std::size_t new_block_size = std::max(block_size_, size + alignment);
+        blocks_.emplace_back(std::unique_ptr<char[]>(new char[new_block_size]), new_block_size);
+
+        position_ = blocks_.back().first.get();
+        end_ = position_ + new_block_size;
+        padding = -reinterpret_cast<std::uintptr_t>(position_) & (alignment - 1);
+      }
+
+      void* result = position_ + padding;
+      position_ += padding + size;
+      bytes_used_ += size;
+
+      return result;
+    }
+
+    inline static thread_local arena* current_ = nullptr;
+
+    std::size_t block_size_;
+    std::vector<std::pair<std::unique_ptr<char[]>, std::size_t>> blocks_;
+    char* position_;
+    char* end_;
+    finalizer* finalizers_;
+    std::size_t object_count_;
+    std::size_t bytes_used_;
+};
+
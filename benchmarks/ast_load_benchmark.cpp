@@ -0,0 +1,158 @@
+// c++ -std=c++17 -O3 -I.. ast_load_benchmark.cpp -o ast_load_benchmark
+//
+// compares loading a program from source, which maps, lexes, and parses it,
+// against loading it from the binary format, which maps it and either converts
+// it to a program or walks it in place. cold loads start by asking the kernel
+// to drop the file's cached pages, so that the file is read from disk
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "../parser.hpp"
+#include "../serialization.hpp"
+
+// generates definitions interleaved with externs, comments, and top-level expressions
+std::string generate_source(std::size_t num_bytes)
+{
+  std::mt19937 rng(0);
+  const char operators[] = {'+', '-', '*', '<'};
+  const char* terms[] = {"x", "y", "1", "2.5", "(x * y)", "f(x, y)"};
+
+  auto body = [&]
+  {
+    std::string result = terms[rng() % 6];
+    for(int i = rng() % 12; i > 0; --i)
+    {
+      result += ' ';
+      result += operators[rng() % 4];
+      result += ' ';
+      result += terms[rng() % 6];
+    }
+
+    return result;
+  };
+
+  std::string result = "extern f(a b);\n";
+  while(result.size() < num_bytes)
+  {
+    switch(rng() % 8)
+    {
+      case 0: result += "# a comment about the next definition\n"; break;
+      case 1: result += "if 1 < 2 then " + body() + " else 0;\n"; break;
+      case 2: result += "def g(x y) for i = 0, i < x in " + body() + "\n"; break;
+      default: result += "def g(x y) " + body() + "\n"; break;
+    }
+  }
+
+  return result;
+}
+
+
+void drop_cached_pages(const std::string& filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd != -1)
+  {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+
+template<class Load>
+void report(const char* name, const std::string& filename, Load load)
+{
+  const int num_repetitions = 5;
+
+  std::cout << "  " << name << ":";
+
+  for(bool cold : {true, false})
+  {
+    std::chrono::duration<double> best(1e9);
+    std::size_t checksum = 0;
+
+    for(int i = 0; i < num_repetitions; ++i)
+    {
+      if(cold)
+      {
+        drop_cached_pages(filename);
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      checksum = load(filename);
+      best = std::min<std::chrono::duration<double>>(best, std::chrono::high_resolution_clock::now() - start);
+    }
+
+    std::cout << " " << (cold ? "cold " : "warm ") << best.count() * 1000 << " ms (" << checksum << " statements)";
+  }
+
+  std::cout << std::endl;
+}
+
+
+int main()
+{
+  std::string source_filename = "ast_load_benchmark.k";
+  std::string binary_filename = "ast_load_benchmark.kast";
+
+  for(std::size_t num_megabytes : {1, 16, 64})
+  {
+    {
+      std::string text = generate_source(num_megabytes << 20);
+      std::ofstream(source_filename, std::ios::binary) << text;
+
+      parser p(source_buffer::from_view(text), parser_options::quiet());
+      save(p.parse_program(), binary_filename);
+    }
+
+    std::ifstream binary(binary_filename, std::ios::binary | std::ios::ate);
+    std::cout << num_megabytes << " MB of source, " << binary.tellg() / double(1 << 20) << " MB serialized:" << std::endl;
+
+    report("parse source   ", source_filename, [](const std::string& filename)
+    {
+      parser p(source_buffer::from_file(filename), parser_options::quiet());
+      return p.parse_program().statements().size();
+    });
+
+    report("convert binary ", binary_filename, [](const std::string& filename)
+    {
+      return serialized_program::from_file(filename).to_program().statements().size();
+    });
+
+    report("walk binary    ", binary_filename, [](const std::string& filename)
+    {
+      serialized_program prog = serialized_program::from_file(filename);
+
+      // visit every node in place
+      std::size_t num_nodes = 0;
+      std::vector<serialized_node> stack;
+      for(std::size_t i = 0; i < prog.num_statements(); ++i)
+      {
+        stack.push_back(prog.statement(i));
+        while(!stack.empty())
+        {
+          serialized_node node = stack.back();
+          stack.pop_back();
+          ++num_nodes;
+
+          for(std::size_t j = 0; j < node.num_children(); ++j)
+          {
+            stack.push_back(node.child(j));
+          }
+        }
+      }
+
+      return num_nodes > 0 ? prog.num_statements() : 0;
+    });
+  }
+
+  std::remove(source_filename.c_str());
+  std::remove(binary_filename.c_str());
+
+  return 0;
+}
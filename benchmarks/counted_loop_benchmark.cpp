@@ -0,0 +1,134 @@
+// clang -std=c++17 -O2 -I.. counted_loop_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// times loop-heavy kernels with loops emitted as written and with loops lowered to
+// integer trip counts, and checks that both visit the same values of the loop
+// variable, including for fractional begins and bounds, and steps other than 1
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+// kernels report each value to the host, so that their loops can't be deleted
+double total = 0;
+double count = 0;
+
+extern "C" double sink(double x)
+{
+  total += x;
+  count += 1;
+  return 0;
+}
+
+const char* kernels = R"(
+  extern sink(x);
+
+  def horner(x) ((((0.5*x + 1.5)*x + 2.5)*x + 3.5)*x + 4.5)*x + 5.5;
+
+  def run_sink(n) for i = 0, i < n in sink(i);
+  def run_nested(n) for i = 0, i < n in for j = 0, j < 100, 2 in sink(i + j);
+  def run_horner(n) for i = 0, i < n in sink(horner(i * 0.001));
+
+  # the loop variable's values for unusual begins, bounds, and steps
+  def edges(x) for i = 0, i < x in sink(i);
+  def edges_from(a n) for i = a, i < n, 3 in sink(i);
+)";
+
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+// returns a checksum of the values the edge cases visited
+double report(const char* name, const codegen_options& options)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    if(const function_prototype* fp = std::get_if<function_prototype>(&statement))
+    {
+      gen.redeclare(*fp);
+      continue;
+    }
+
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  std::cout << "  " << name << ":";
+
+  for(const char* kernel : {"run_sink", "run_nested", "run_horner"})
+  {
+    auto f = reinterpret_cast<double(*)(double)>(*compiler.find_symbol(kernel).getAddress());
+    std::cout << " " << kernel << " " << measure([&]{ f(1e7); }).count() * 1000 << " ms";
+  }
+
+  std::cout << std::endl;
+
+  auto edges = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("edges").getAddress());
+  auto edges_from = reinterpret_cast<double(*)(double, double)>(*compiler.find_symbol("edges_from").getAddress());
+
+  total = count = 0;
+
+  for(double bound : {-3.0, 0.0, 0.5, 1.0, 7.0, 7.25, 1e3 + 0.5})
+  {
+    edges(bound);
+  }
+
+  // a fractional begin is run as written
+  for(double begin : {0.0, -4.0, 2.5})
+  {
+    for(double bound : {-1.0, 10.0, 10.5, 1e4 + 0.5})
+    {
+      edges_from(begin, bound);
+    }
+  }
+
+  return total * 31 + count;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  std::cout << "10^7 iterations of each kernel:" << std::endl;
+
+  double checksums[4];
+
+  for(optimization_level level : {optimization_level::O2, optimization_level::O3})
+  {
+    codegen_options options = codegen_options::with_optimization(level);
+    int i = level == optimization_level::O2 ? 0 : 2;
+
+    options.counted_loops = false;
+    checksums[i] = report(level == optimization_level::O2 ? "O2, as written" : "O3, as written", options);
+
+    options.counted_loops = true;
+    checksums[i + 1] = report(level == optimization_level::O2 ? "O2, counted   " : "O3, counted   ", options);
+  }
+
+  bool same = std::equal(checksums + 1, checksums + 4, checksums);
+  std::cout << "edge cases " << (same ? "visit the same values" : "DIFFER") << std::endl;
+
+  return same ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// clang -std=c++17 -O2 -I.. deep_expression_benchmark.cpp -lstdc++ `llvm-config --cppflags --ldflags --system-libs --libs core native`
+//
+// parses, generates IR for, and tears down machine-generated expressions of
+// 10^3 to 10^6 terms, reporting the time of each phase and the peak memory
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+
+// def f(x) x+x+...+x
+std::string generate_long_chain(int num_terms)
+{
+  std::string result = "def f(x) x";
+  for(int i = 1; i < num_terms; ++i)
+  {
+    result += "+x";
+  }
+
+  return result + ";";
+}
+
+
+// def f(x) (((x+1)+1)...+1)
+std::string generate_deep_nesting(int num_terms)
+{
+  std::string result = "def f(x) " + std::string(num_terms - 1, '(') + "x";
+  for(int i = 1; i < num_terms; ++i)
+  {
+    result += "+1)";
+  }
+
+  return result + ";";
+}
+
+
+double peak_memory_in_megabytes()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  // ru_maxrss is in kilobytes on Linux
+  return usage.ru_maxrss / 1024.0;
+}
+
+
+void benchmark(const char* shape, int num_terms, const std::string& source)
+{
+  // run each case in its own process so that its peak memory is its own
+  if(pid_t child = fork())
+  {
+    waitpid(child, nullptr, 0);
+    return;
+  }
+
+  using clock = std::chrono::high_resolution_clock;
+
+  parser p(source_buffer::from_string(source));
+  generator gen;
+
+  // silence the parser's chatter
+  std::cout.setstate(std::ios::failbit);
+
+  auto start = clock::now();
+  top_level_statement statement = p.parse_top_level_statement();
+  std::chrono::duration<double> parse_seconds = clock::now() - start;
+
+  start = clock::now();
+  gen.visitor()(std::get<function>(statement));
+  std::chrono::duration<double> codegen_seconds = clock::now() - start;
+
+  start = clock::now();
+  p.release_arena();
+  std::chrono::duration<double> teardown_seconds = clock::now() - start;
+
+  std::cout.clear();
+  std::cout << shape << ", " << num_terms << " terms: "
+            << "parse " << parse_seconds.count() << " s, "
+            << "codegen " << codegen_seconds.count() << " s, "
+            << "teardown " << teardown_seconds.count() << " s, "
+            << "peak memory " << peak_memory_in_megabytes() << " MB" << std::endl;
+
+  std::exit(0);
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  for(int num_terms = 1000; num_terms <= 1000000; num_terms *= 10)
+  {
+    benchmark("long chain", num_terms, generate_long_chain(num_terms));
+  }
+
+  for(int num_terms = 1000; num_terms <= 1000000; num_terms *= 10)
+  {
+    benchmark("deep nesting", num_terms, generate_deep_nesting(num_terms));
+  }
+
+  return 0;
+}
+
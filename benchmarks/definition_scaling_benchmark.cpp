@@ -0,0 +1,86 @@
+// clang -std=c++17 -O2 -I.. definition_scaling_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// reports the time per definition of generating and releasing sessions of up to
+// 100k definitions, each of which calls the one before it, along with the number
+// of declarations in the released modules. since functions are declared only
+// where they're called, both should stay flat as the session grows
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+std::string name_of(int i)
+{
+  std::string result = "f";
+  for(int n = i; n > 0; n /= 26)
+  {
+    result += 'a' + n % 26;
+  }
+
+  return result;
+}
+
+
+void report(int num_definitions)
+{
+  // parse definitions up front, so that only code generation is timed
+  std::string text = "def " + name_of(0) + "(x) x;\n";
+  for(int i = 1; i < num_definitions; ++i)
+  {
+    text += "def " + name_of(i) + "(x) " + name_of(i - 1) + "(x) + " + std::to_string(i) + ";\n";
+  }
+
+  parser p(source_buffer::from_view(text), parser_options::quiet());
+  program prog = p.parse_program();
+
+  // without optimization, so that the time is spent generating and releasing modules
+  target_context target(codegen_options::with_optimization(optimization_level::O0));
+  generator gen(target);
+
+  std::size_t num_declarations = 0;
+
+  seconds per_definition = measure([&]
+  {
+    for(const top_level_statement& statement : prog.statements())
+    {
+      gen.visitor()(std::get<function>(statement));
+      std::unique_ptr<llvm::Module> m = gen.release_module();
+
+      for(const llvm::Function& f : *m)
+      {
+        num_declarations += f.isDeclaration();
+      }
+    }
+  }) / num_definitions;
+
+  std::cout << "  " << num_definitions << " definitions: " << per_definition.count() * 1e6 << " us per definition, "
+            << double(num_declarations) / num_definitions << " declarations per module" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  for(int num_definitions : {1000, 10000, 100000})
+  {
+    report(num_definitions);
+  }
+
+  return 0;
+}
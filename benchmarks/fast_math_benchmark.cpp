@@ -0,0 +1,79 @@
+// clang -std=c++17 -O2 -I.. fast_math_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit`
+//
+// times arithmetic-heavy loops compiled for a generic CPU and for the host's,
+// with strict IEEE arithmetic, with contraction into fused multiply-adds, and
+// with all fast-math flags
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+const char* kernels = R"(
+  # a polynomial in Horner form, which contracts into a chain of fused multiply-adds
+  def horner(x) ((((0.5*x + 1.5)*x + 2.5)*x + 3.5)*x + 4.5)*x + 5.5;
+
+  # sums of products, which fast-math may also reassociate
+  def dot3(a b c x y z) a*x + b*y + c*z;
+  def mix(x y) dot3(x, y, x*y, y, x, x + y) * dot3(y, x, 1.5, x, y, 2.5);
+
+  def run_horner(n) for i = 0, i < n in horner(i * 0.001);
+  def run_mix(n) for i = 0, i < n in mix(i * 0.001, 1 - i * 0.001);
+)";
+
+
+void report(const char* name, const codegen_options& options)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  std::cout << "  " << name << ":";
+
+  for(const char* kernel : {"run_horner", "run_mix"})
+  {
+    auto f = reinterpret_cast<double(*)(double)>(*compiler.find_symbol(kernel).getAddress());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    f(1e7);
+    std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+
+    std::cout << " " << kernel << " " << seconds.count() * 1000 << " ms";
+  }
+
+  std::cout << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  std::cout << "10^7 iterations of each loop, on " << llvm::sys::getHostCPUName().str() << ":" << std::endl;
+
+  report("generic CPU, strict ", codegen_options::generic());
+  report("host CPU, strict    ", codegen_options::host());
+  report("host CPU, fused     ", codegen_options::with_accuracy(float_accuracy::fused));
+
+  codegen_options finite = codegen_options::with_accuracy(float_accuracy::fused);
+  finite.allow_reassociation = true;
+  finite.no_nans = true;
+  finite.no_infs = true;
+  report("host CPU, finite    ", finite);
+
+  report("host CPU, fast      ", codegen_options::with_accuracy(float_accuracy::fast));
+
+  return 0;
+}
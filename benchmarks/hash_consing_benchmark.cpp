@@ -0,0 +1,108 @@
+// clang -std=c++17 -O2 -I.. hash_consing_benchmark.cpp -lstdc++ `llvm-config --cppflags --ldflags --system-libs --libs core native`
+//
+// parses and generates IR for machine-generated definitions which repeat the same
+// subexpressions many times, with and without sharing equal subtrees, and reports
+// the AST's size, the time of each phase, and the size of the generated IR
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+
+// generates definitions like
+//
+//   def f(x y z) if x < y then (x*x + y*y) * z + (x*x + y*y) else (x*x + y*y) - (y*z + 1) * (y*z + 1)
+std::string generate_definitions(int num_definitions, int num_repetitions)
+{
+  std::mt19937 rng(0);
+  const char* subexpressions[] = {"(x*x + y*y)", "(y*z + 1)", "(x - z) * (x - z)", "(x*y*z + x + y + z)"};
+  const char operators[] = {'+', '-', '*'};
+
+  auto generate_sum = [&]
+  {
+    std::string result = subexpressions[rng() % 4];
+    for(int i = 1; i < num_repetitions; ++i)
+    {
+      result += ' ';
+      result += operators[rng() % 3];
+      result += ' ';
+      result += subexpressions[rng() % 4];
+    }
+
+    return result;
+  };
+
+  std::string result;
+  for(int i = 0; i < num_definitions; ++i)
+  {
+    result += "def f(x y z) if x < y then " + generate_sum() + " else " + generate_sum() + "\n";
+  }
+
+  return result;
+}
+
+
+void benchmark(const std::string& text, bool share_subexpressions)
+{
+  parser_options options = parser_options::quiet();
+  options.share_subexpressions = share_subexpressions;
+
+  parser p(source_buffer::from_view(text), options);
+  generator gen;
+
+  std::chrono::duration<double> parse_seconds(0), codegen_seconds(0);
+  std::size_t num_nodes = 0, num_arena_bytes = 0, num_instructions = 0;
+
+  while(p.current_token() != token(char(EOF)))
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    top_level_statement statement = p.parse_top_level_statement();
+
+    auto parsed = std::chrono::high_resolution_clock::now();
+
+    llvm::Function& f = gen.visitor()(std::get<function>(statement));
+
+    auto generated = std::chrono::high_resolution_clock::now();
+
+    parse_seconds += parsed - start;
+    codegen_seconds += generated - parsed;
+    for(const llvm::BasicBlock& block : f)
+    {
+      num_instructions += block.size();
+    }
+
+    gen.release_module();
+    std::unique_ptr<arena> nodes = p.release_arena();
+    num_nodes += nodes->object_count();
+    num_arena_bytes += nodes->bytes_used();
+  }
+
+  std::cout << "  " << (share_subexpressions ? "shared:  " : "unshared:")
+            << " " << num_nodes << " nodes, "
+            << num_arena_bytes / 1024 << " KB of nodes, "
+            << "parse " << parse_seconds.count() * 1000 << " ms, "
+            << "codegen " << codegen_seconds.count() * 1000 << " ms, "
+            << num_instructions << " instructions after optimization" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  for(int num_repetitions : {4, 16, 64})
+  {
+    std::string text = generate_definitions(2000, num_repetitions);
+
+    std::cout << "2000 definitions of " << num_repetitions << " repeated subexpressions per branch:" << std::endl;
+    benchmark(text, false);
+    benchmark(text, true);
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,111 @@
+// clang -std=c++17 -O2 -I.. incremental_reload_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit`
+//
+// loads a file of many definitions into an incremental_session, then reloads it
+// unchanged, with a comment edited, and with a single definition edited, and
+// compares each reload with loading the file into a fresh session
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../incremental_session.hpp"
+
+std::string name_of(int i)
+{
+  // identifiers are alphabetic, so spell i in base 26
+  std::string result = "helper";
+  for(int n = i; n > 0; n /= 26)
+  {
+    result += 'a' + n % 26;
+  }
+
+  return result;
+}
+
+
+// each definition calls the previous one every tenth definition, so that
+// an edit to one definition invalidates a few of its callers
+std::string generate_file(int num_definitions, int edited, const char* edited_body)
+{
+  std::string result;
+  for(int i = 0; i < num_definitions; ++i)
+  {
+    result += "# " + name_of(i) + "\n";
+    result += "def " + name_of(i) + "(x y) ";
+    result += i == edited ? edited_body : "(x + y) * (x - y) + " + std::to_string(i);
+    if(i % 10 != 0)
+    {
+      result += " + " + name_of(i - 1) + "(x, y)";
+    }
+    result += "\n";
+  }
+
+  // a few top-level expressions
+  for(int i = 0; i < num_definitions; i += num_definitions / 8)
+  {
+    result += name_of(i) + "(1, 2);\n";
+  }
+
+  return result;
+}
+
+
+template<class Function>
+void report(const char* name, Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  incremental_session::load_statistics statistics = f();
+
+  std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+  std::cerr << "  " << name << ": " << seconds.count() * 1000 << " ms ("
+            << statistics.num_reused << " reused, "
+            << statistics.num_parsed << " parsed, "
+            << statistics.num_recompiled << " recompiled, "
+            << statistics.num_evaluated << " evaluated)" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  // silence "Evaluated to" reports
+  std::cout.setstate(std::ios::failbit);
+
+  for(int num_definitions : {500, 2000})
+  {
+    std::string original = generate_file(num_definitions, -1, "");
+    std::string comment_edited = "# a new comment\n" + original;
+    std::string definition_edited = generate_file(num_definitions, num_definitions / 2 + 5, "x * y");
+
+    std::cerr << num_definitions << " definitions:" << std::endl;
+
+    report("load into a fresh session", [&]
+    {
+      incremental_session fresh;
+      return fresh.load(definition_edited);
+    });
+
+    incremental_session session;
+    session.load(original);
+
+    report("reload unchanged", [&]
+    {
+      return session.load(original);
+    });
+
+    report("reload with a comment edited", [&]
+    {
+      return session.load(comment_edited);
+    });
+
+    report("reload with one definition edited", [&]
+    {
+      return session.load(definition_edited);
+    });
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,152 @@
+// clang -std=c++17 -O2 -I.. lazy_compilation_benchmark.cpp -lstdc++ -rdynamic -pthread `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes bitreader bitwriter`
+//
+// loads a prelude of 10k definitions and calls a handful of them, compiling
+// every definition as it is added, and compiling each only on its first call
+//
+// also checks that compiling a deferred module doesn't undo a later redefinition
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+extern "C" double putchard(double x)
+{
+  std::cout << static_cast<char>(x);
+  return 0;
+}
+
+std::string name_of(int i)
+{
+  // identifiers are alphabetic, so spell i in base 26
+  std::string result = "prelude";
+  for(int n = i; n > 0; n /= 26)
+  {
+    result += 'a' + n % 26;
+  }
+
+  return result;
+}
+
+
+// every tenth definition calls the one before it, so calling one may compile another
+std::string generate_prelude(int num_definitions)
+{
+  std::string result;
+  for(int i = 0; i < num_definitions; ++i)
+  {
+    result += "def " + name_of(i) + "(x y) if x < y then (x + y) * (x - y) else x * y + " + std::to_string(i);
+    if(i % 10 == 9)
+    {
+      result += " + " + name_of(i - 1) + "(y, x)";
+    }
+    result += ";\n";
+  }
+
+  return result;
+}
+
+
+void report(const char* name, const codegen_options& options, const program& prelude)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  for(const top_level_statement& statement : prelude.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  std::chrono::duration<double> load_time = std::chrono::high_resolution_clock::now() - start;
+
+  // call a handful of functions
+  double sum = 0;
+  for(int i : {0, 9, 1234, 5679, 9999})
+  {
+    auto f = reinterpret_cast<double(*)(double, double)>(*compiler.find_symbol(name_of(i)).getAddress());
+    sum += f(1, 2);
+  }
+
+  std::chrono::duration<double> total_time = std::chrono::high_resolution_clock::now() - start;
+
+  jit_statistics statistics = compiler.statistics();
+  std::cout << "  " << name << ": load " << load_time.count() * 1000 << " ms, load and call "
+            << total_time.count() * 1000 << " ms ("
+            << statistics.num_deferred << " deferred, "
+            << statistics.num_compiled_on_first_call << " compiled on first call, sum " << sum << ")" << std::endl;
+}
+
+
+// redefining g with effects regenerates f, its caller, in g's module, which is deferred until g's first call
+// f is then redefined again, so compiling g's module mustn't point f's stub back at the regenerated f
+bool check_redefinition_while_deferred()
+{
+  target_context target(codegen_options::lazy_compilation());
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  parser p(source_buffer::from_view("def g(x) x + 1; def f(x) g(x) * 2; extern putchard(c); def g(x) putchard(x); def f(x) 5;"), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    if(const function* f = std::get_if<function>(&statement))
+    {
+      gen.visitor()(*f);
+      compiler.add_module(gen.release_module());
+    }
+    else
+    {
+      gen.visitor()(std::get<function_prototype>(statement));
+    }
+  }
+
+  auto call = [&](const char* name, double x)
+  {
+    return reinterpret_cast<double(*)(double)>(*compiler.find_symbol(name).getAddress())(x);
+  };
+
+  call("g", 65);
+  double result = call("f", 1);
+  std::cout << std::endl;
+
+  if(result != 5)
+  {
+    std::cerr << "  f(1) evaluated to " << result << " after f was redefined as 5" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  if(!check_redefinition_while_deferred())
+  {
+    return 1;
+  }
+
+  const int num_definitions = 10000;
+  std::string text = generate_prelude(num_definitions);
+
+  std::cout << num_definitions << " definitions, 5 called:" << std::endl;
+
+  // both loads generate IR for the whole prelude, so parse it once
+  parser p(source_buffer::from_view(text), parser_options::quiet());
+  program prelude = p.parse_program();
+
+  report("eager", codegen_options::host(), prelude);
+  report("lazy ", codegen_options::lazy_compilation(), prelude);
+
+  return 0;
+}
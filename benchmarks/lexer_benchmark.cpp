@@ -0,0 +1,433 @@
+// c++ -std=c++17 -O3 -I.. lexer_benchmark.cpp -o lexer_benchmark
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../lexer.hpp"
+
+// the stdio lexer which lexer replaced, kept here for comparison
+namespace legacy
+{
+
+
+using token = std::variant<keyword, std::string, double, char>;
+
+inline token get_token(FILE* stream)
+{
+  char last_char = ' ';
+
+  // skip whitespace
+  while(isspace(last_char = getc(stream)))
+  {
+    ;
+  }
+
+  // get an identifier or keyword
+  if(isalpha(last_char))
+  {
+    std::string word(1, last_char);
+    while(isalpha((last_char = getc(stream))))
+    {
+      word += last_char;
+    }
+
+    // put back the last char
+    ungetc(last_char, stream);
+
+    if(word == "def") return keyword::def;
+    else if(word == "else") return keyword::else_;
+    else if(word == "extern") return keyword::extern_;
+    else if(word == "for") return keyword::for_;
+    else if(word == "if") return keyword::if_;
+    else if(word == "in") return keyword::in;
+    else if(word == "then") return keyword::then;
+
+    return word;
+  }
+
+  // get a number
+  else if(isdigit(last_char) || last_char == '.')
+  {
+    std::string number(1, last_char);
+    while(isdigit(last_char = getc(stream)) || last_char == '.')
+    {
+      number += last_char;
+    }
+
+    // put back the last char
+    ungetc(last_char, stream);
+
+    // convert the string to a double
+    return strtod(number.c_str(), 0);
+  }
+
+  // skip comments
+  else if(last_char == '#')
+  {
+    while((last_char = getc(stream)) != EOF and last_char != '\n' and last_char != '\r')
+    {
+      ;
+    }
+
+    if(last_char != EOF)
+    {
+      return get_token(stream);
+    }
+  }
+
+  // check for EOF
+  else if(last_char == EOF)
+  {
+    return token(char(EOF));
+  }
+  
+  // just return the last character
+  return last_char;
+}
+
+
+} // end legacy
+
+
+// generates a program resembling our machine-generated inputs
+std::string generate_program(std::size_t num_bytes)
+{
+  std::mt19937 rng(13);
+  std::string result;
+
+  int i = 0;
+  while(result.size() < num_bytes)
+  {
+    std::string name = "helper" + std::string(1, 'a' + i % 26) + std::string(1, 'a' + (i / 26) % 26);
+
+    result += "# " + name + " was generated automatically\n";
+    result += "def " + name + "(x y)\n";
+    result += "  if x < " + std::to_string(rng() % 1000) + ".5 then\n";
+    result += "    x * y + " + std::to_string(rng() % 100) + "\n";
+    result += "  else\n";
+    result += "    for i = 0, i < y, 1.0 in\n";
+    result += "      putchard(x - i);\n";
+    result += name + "(" + std::to_string(rng() % 10) + ", 2.25);\n\n";
+
+    ++i;
+  }
+
+  return result;
+}
+
+
+std::string random_word(std::mt19937& rng)
+{
+  std::string result(2 + rng() % 10, 'a');
+  for(char& c : result)
+  {
+    c = 'a' + rng() % 26;
+  }
+
+  return result;
+}
+
+
+std::string random_number(std::mt19937& rng)
+{
+  return std::to_string(rng() % 100000) + "." + std::to_string(rng() % 10000);
+}
+
+
+// long expressions over a large vocabulary of identifiers, sprinkled with keywords
+std::string generate_identifier_heavy_program(std::size_t num_bytes)
+{
+  std::mt19937 rng(7);
+  std::string result;
+
+  std::vector<std::string> vocabulary;
+  for(int i = 0; i < 1 << 14; ++i)
+  {
+    vocabulary.push_back(random_word(rng));
+  }
+
+  auto random_word = [&](std::mt19937& rng)
+  {
+    return vocabulary[rng() % vocabulary.size()];
+  };
+
+  while(result.size() < num_bytes)
+  {
+    result += "def " + random_word(rng) + "(" + random_word(rng) + " " + random_word(rng) + ")\n  ";
+    for(int i = 0; i < 16; ++i)
+    {
+      result += (i % 5 == 4) ? "if " : "";
+      result += random_word(rng) + (i % 5 == 4 ? " then " : " + ");
+    }
+    result += random_word(rng) + " else " + random_word(rng) + ";\n";
+  }
+
+  return result;
+}
+
+
+// long arithmetic over numeric literals
+std::string generate_number_heavy_program(std::size_t num_bytes)
+{
+  std::mt19937 rng(11);
+  std::string result;
+
+  while(result.size() < num_bytes)
+  {
+    for(int i = 0; i < 16; ++i)
+    {
+      result += random_number(rng) + " * ";
+    }
+    result += random_number(rng) + ";\n";
+  }
+
+  return result;
+}
+
+
+// deeply indented code under long comment banners
+std::string generate_comment_dense_program(std::size_t num_bytes)
+{
+  std::mt19937 rng(17);
+  std::string result;
+
+  const std::string banner = "#" + std::string(78, '=') + "\n";
+
+  while(result.size() < num_bytes)
+  {
+    result += banner;
+    result += "# " + random_word(rng) + ": this function was generated from a model description and\n";
+    result += "#   should not be edited by hand; regenerate it instead\n";
+    result += banner;
+    result += "def " + random_word(rng) + "(x)\n";
+    result += "                if x < 1 then\n";
+    result += "                                x  # the base case\n";
+    result += "                else\n";
+    result += "                                x * 2;\n\n\n";
+  }
+
+  return result;
+}
+
+
+template<class Function>
+void report(const char* name, std::size_t num_bytes, Function&& lex_all)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  std::size_t num_tokens = lex_all();
+  std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+
+  std::cout << "  " << name << ": "
+            << num_tokens << " tokens in " << seconds.count() << " s, "
+            << num_tokens / seconds.count() / 1e6 << " Mtokens/s, "
+            << num_bytes / seconds.count() / (1 << 20) << " MB/s" << std::endl;
+}
+
+
+template<class Function>
+void report_per_item(const char* name, std::size_t num_items, Function&& f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  std::size_t checksum = f();
+  std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+
+  std::cout << "  " << name << ": "
+            << seconds.count() / num_items * 1e9 << " ns/item"
+            << " (checksum " << checksum << ")" << std::endl;
+}
+
+
+void benchmark_lexers(const char* workload, const std::string& program)
+{
+  std::cout << workload << " (" << program.size() / (1 << 20) << " MB):" << std::endl;
+
+  // write the program to a file so each lexer reads the same bytes
+  char filename[] = "/tmp/lexer_benchmark_XXXXXX";
+  int fd = mkstemp(filename);
+  if(fd == -1 or write(fd, program.data(), program.size()) != ssize_t(program.size()))
+  {
+    std::cerr << "Could not write " << filename << std::endl;
+    std::exit(1);
+  }
+  close(fd);
+
+  report("legacy getc/ungetc", program.size(), [&]
+  {
+    FILE* stream = fopen(filename, "r");
+    std::size_t n = 0;
+    while(legacy::get_token(stream) != legacy::token(char(EOF)))
+    {
+      ++n;
+    }
+    fclose(stream);
+    return n;
+  });
+
+  auto lex_all = [](lexer lex)
+  {
+    std::size_t n = 0;
+    while(lex.next() != token(char(EOF)))
+    {
+      ++n;
+    }
+    return n;
+  };
+
+  report("lexer over string", program.size(), [&]
+  {
+    return lex_all(lexer(source_buffer::from_string(program)));
+  });
+
+  report("lexer over mmap", program.size(), [&]
+  {
+    return lex_all(lexer(source_buffer::from_file(filename)));
+  });
+
+  report("lexer over stream", program.size(), [&]
+  {
+    int fd = open(filename, O_RDONLY);
+    std::size_t n = lex_all(lexer(source_buffer::from_stream(fd)));
+    close(fd);
+    return n;
+  });
+
+  unlink(filename);
+}
+
+
+void benchmark_keyword_recognition()
+{
+  std::cout << "keyword recognition:" << std::endl;
+
+  std::mt19937 rng(3);
+  std::vector<std::string> words;
+  for(int i = 0; i < 1 << 20; ++i)
+  {
+    // one word in four is a keyword
+    words.push_back(i % 4 ? random_word(rng) : std::string(detail::keyword_spellings[rng() % 7].spelling));
+  }
+
+  report_per_item("compare chain", words.size(), [&]
+  {
+    std::size_t n = 0;
+    for(const std::string& word : words)
+    {
+      n += word == "def" or word == "else" or word == "extern" or word == "for" or word == "if" or word == "in" or word == "then";
+    }
+    return n;
+  });
+
+  report_per_item("perfect hash", words.size(), [&]
+  {
+    std::size_t n = 0;
+    for(const std::string& word : words)
+    {
+      n += find_keyword(word).has_value();
+    }
+    return n;
+  });
+}
+
+
+void benchmark_number_conversion()
+{
+  std::cout << "number conversion:" << std::endl;
+
+  std::mt19937 rng(5);
+  std::vector<std::string> numbers;
+  for(int i = 0; i < 1 << 20; ++i)
+  {
+    numbers.push_back(random_number(rng));
+  }
+
+  report_per_item("copy + strtod", numbers.size(), [&]
+  {
+    double sum = 0;
+    for(const std::string& number : numbers)
+    {
+      std::string copy(number.data(), number.size());
+      sum += strtod(copy.c_str(), 0);
+    }
+    return std::size_t(sum);
+  });
+
+  report_per_item("from_chars", numbers.size(), [&]
+  {
+    double sum = 0;
+    for(const std::string& number : numbers)
+    {
+      double value = 0;
+      std::from_chars(number.data(), number.data() + number.size(), value, std::chars_format::fixed);
+      sum += value;
+    }
+    return std::size_t(sum);
+  });
+}
+
+
+void benchmark_search(const char* workload, const std::string& program, bool (*pred)(char), detail::search_function search)
+{
+  std::cout << workload << ":" << std::endl;
+
+  // time searches from every position which starts a run
+  std::vector<std::size_t> starts;
+  for(std::size_t i = 0; i < program.size(); ++i)
+  {
+    if(pred(program[i]) and (i == 0 or !pred(program[i-1])))
+    {
+      starts.push_back(i);
+    }
+  }
+
+  auto run = [&](const char* name, detail::search_function search)
+  {
+    report_per_item(name, starts.size(), [&]
+    {
+      std::size_t checksum = 0;
+      for(std::size_t start : starts)
+      {
+        checksum += search(program.data() + start, program.data() + program.size()) - program.data();
+      }
+      return checksum;
+    });
+  };
+
+  run("scalar", search);
+
+#if defined(__x86_64__) || defined(__i386__)
+  if(search == detail::find_non_space_scalar)
+  {
+    run("sse2", detail::find_non_space_sse2);
+    if(__builtin_cpu_supports("avx2")) run("avx2", detail::find_non_space_avx2);
+  }
+  else
+  {
+    run("sse2", detail::find_line_end_sse2);
+    if(__builtin_cpu_supports("avx2")) run("avx2", detail::find_line_end_avx2);
+  }
+#endif
+}
+
+
+int main(int argc, char** argv)
+{
+  std::size_t num_bytes = argc > 1 ? std::stoul(argv[1]) : 64 << 20;
+
+  benchmark_lexers("mixed program", generate_program(num_bytes));
+  benchmark_lexers("identifier-heavy program", generate_identifier_heavy_program(num_bytes));
+  benchmark_lexers("number-heavy program", generate_number_heavy_program(num_bytes));
+
+  std::string comment_dense_program = generate_comment_dense_program(num_bytes);
+  benchmark_lexers("comment-dense program", comment_dense_program);
+
+  benchmark_search("whitespace runs in comment-dense program", comment_dense_program, is_space, detail::find_non_space_scalar);
+  benchmark_search("comments in comment-dense program", comment_dense_program, [](char c) { return c == '#'; }, detail::find_line_end_scalar);
+
+  benchmark_keyword_recognition();
+  benchmark_number_conversion();
+
+  return 0;
+}
+
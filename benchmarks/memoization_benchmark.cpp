@@ -0,0 +1,82 @@
+// clang -std=c++17 -O2 -I.. memoization_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// times naively recursive functions with and without memoization, with caches
+// large enough for every distinct call and too small for them, and reports the
+// caches' hits, misses, and evictions
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+const char* kernels = R"(
+  def fib(n) if n < 3 then 1 else fib(n - 1) + fib(n - 2);
+
+  # binomial coefficients by Pascal's rule
+  def choose(n k) if k < 1 then 1 else if n < k + 1 then 1 else choose(n - 1, k - 1) + choose(n - 1, k);
+)";
+
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+void report(const char* name, const codegen_options& options)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  auto fib = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("fib").getAddress());
+  auto choose = reinterpret_cast<double(*)(double, double)>(*compiler.find_symbol("choose").getAddress());
+
+  double fib_result = 0, choose_result = 0;
+  seconds fib_time = measure([&]{ fib_result = fib(35); });
+  seconds choose_time = measure([&]{ choose_result = choose(28, 14); });
+
+  jit_statistics statistics = compiler.statistics();
+  std::cout << "  " << name << ": fib(35) = " << fib_result << " in " << fib_time.count() * 1000 << " ms"
+            << ", choose(28, 14) = " << choose_result << " in " << choose_time.count() * 1000 << " ms"
+            << " (" << statistics.num_memo_hits << " hits, "
+            << statistics.num_memo_misses << " misses, "
+            << statistics.num_memo_evictions << " evictions)" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  report("not memoized     ", codegen_options());
+  report("memoized         ", codegen_options::memoized_recursion());
+
+  // too small for choose's 200 or so distinct calls
+  codegen_options small = codegen_options::memoized_recursion();
+  small.memo_capacity = 64;
+  report("64 entries, LRU  ", small);
+
+  small.memo_eviction_policy = memo_eviction::none;
+  report("64 entries, keep ", small);
+
+  return 0;
+}
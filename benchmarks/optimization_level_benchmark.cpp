@@ -0,0 +1,86 @@
+// clang -std=c++17 -O2 -I.. optimization_level_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// for each optimization level, and for a custom pipeline like the one the
+// generator used to hard-code, reports the time to generate, optimize, and
+// compile a few kernels against the time to run them
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+const char* kernels = R"(
+  def fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);
+
+  def horner(x) ((((0.5*x + 1.5)*x + 2.5)*x + 3.5)*x + 4.5)*x + 5.5;
+  def run_horner(n) for i = 0, i < n in horner(i * 0.001);
+
+  def run_nested(n) for i = 0, i < n in for j = 0, j < 100 in horner(i + j);
+)";
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+void report(const char* name, const codegen_options& options)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  double (*fib)(double) = nullptr;
+  double (*run_horner)(double) = nullptr;
+  double (*run_nested)(double) = nullptr;
+
+  seconds compile_time = measure([&]
+  {
+    for(const top_level_statement& statement : prog.statements())
+    {
+      gen.visitor()(std::get<function>(statement));
+      compiler.add_module(gen.release_module());
+    }
+
+    // asking for the addresses finishes compilation
+    fib = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("fib").getAddress());
+    run_horner = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("run_horner").getAddress());
+    run_nested = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("run_nested").getAddress());
+  });
+
+  std::cout << "  " << name << ": compile " << compile_time.count() * 1000 << " ms";
+  std::cout << ", fib(32) " << measure([&]{ fib(32); }).count() * 1000 << " ms";
+  std::cout << ", horner 10^7 " << measure([&]{ run_horner(1e7); }).count() * 1000 << " ms";
+  std::cout << ", nested 10^5 x 100 " << measure([&]{ run_nested(1e5); }).count() * 1000 << " ms";
+  std::cout << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  report("O0    ", codegen_options::with_optimization(optimization_level::O0));
+  report("O1    ", codegen_options::with_optimization(optimization_level::O1));
+  report("O2    ", codegen_options::with_optimization(optimization_level::O2));
+  report("O3    ", codegen_options::with_optimization(optimization_level::O3));
+
+  // the pipeline the generator used before optimization levels were selectable, with no module pipeline
+  codegen_options custom = codegen_options::with_optimization(optimization_level::O0);
+  custom.function_passes = "instcombine,reassociate,gvn,simplifycfg";
+  report("custom", custom);
+
+  return 0;
+}
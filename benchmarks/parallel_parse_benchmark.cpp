@@ -0,0 +1,136 @@
+// c++ -std=c++17 -O3 -pthread -I.. parallel_parse_benchmark.cpp -o parallel_parse_benchmark
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include "../parallel_parser.hpp"
+
+// generates a bulk-load file: definitions interleaved with externs, comments, and top-level expressions
+std::string generate_bulk_load(std::size_t num_bytes)
+{
+  std::mt19937 rng(0);
+  const char operators[] = {'+', '-', '*', '<'};
+  const char* terms[] = {"x", "y", "1", "2.5", "(x * y)"};
+
+  auto body = [&]
+  {
+    std::string result = terms[rng() % 5];
+    for(int i = rng() % 8; i > 0; --i)
+    {
+      result += ' ';
+      result += operators[rng() % 4];
+      result += ' ';
+      result += terms[rng() % 5];
+    }
+
+    return result;
+  };
+
+  std::string result;
+  for(int i = 0; result.size() < num_bytes; ++i)
+  {
+    // identifiers are alphabetic, so spell i in base 26
+    std::string name = "helper";
+    for(int n = i; n > 0; n /= 26)
+    {
+      name += 'a' + n % 26;
+    }
+
+    switch(rng() % 8)
+    {
+      case 0:
+        result += "# " + name + " is defined elsewhere; def and extern in comments don't start statements\n";
+        result += "extern " + name + "(x y);\n";
+        break;
+
+      case 1:
+        result += name + "(1, 2) + " + body() + ";\n";
+        break;
+
+      case 2:
+        result += "def " + name + "(x y)\n  if x < y then " + body() + " else\n    for i = 1, i < x, 1.0 in " + body() + "\n";
+        break;
+
+      default:
+        result += "def " + name + "(x y) " + body() + "\n";
+        break;
+    }
+  }
+
+  return result;
+}
+
+
+double parse_seconds(const std::string& text, std::size_t num_threads, std::size_t& num_statements)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  program prog = parse_program_in_parallel(text, num_threads);
+
+  std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+
+  num_statements = prog.statements().size();
+  return seconds.count();
+}
+
+
+int main()
+{
+  std::string text = generate_bulk_load(64 << 20);
+  std::size_t max_num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::cout << "bulk load (" << text.size() / (1 << 20) << " MB), up to " << max_num_threads << " threads:" << std::endl;
+
+  // the serial parse is the baseline, and its statement count is the expected result
+  std::size_t expected_num_statements = 0;
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    parser p(source_buffer::from_view(text), parser_options::quiet());
+    expected_num_statements = p.parse_program().statements().size();
+
+    std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "  serial parser:  " << seconds.count() * 1000 << " ms, "
+              << text.size() / seconds.count() / (1 << 20) << " MB/s, "
+              << expected_num_statements << " statements" << std::endl;
+  }
+
+  // powers of two, and the largest thread count
+  std::vector<std::size_t> thread_counts;
+  for(std::size_t num_threads = 1; num_threads < max_num_threads; num_threads *= 2)
+  {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(max_num_threads);
+
+  double one_thread_seconds = 0;
+  for(std::size_t num_threads : thread_counts)
+  {
+    // take the best of a few runs
+    std::size_t num_statements = 0;
+    double seconds = parse_seconds(text, num_threads, num_statements);
+    for(int i = 0; i < 2; ++i)
+    {
+      seconds = std::min(seconds, parse_seconds(text, num_threads, num_statements));
+    }
+
+    if(num_threads == 1)
+    {
+      one_thread_seconds = seconds;
+    }
+
+    std::cout << "  " << num_threads << " thread(s): " << seconds * 1000 << " ms, "
+              << text.size() / seconds / (1 << 20) << " MB/s, speedup "
+              << one_thread_seconds / seconds << "x" << std::endl;
+
+    if(num_statements != expected_num_statements)
+    {
+      std::cerr << "  parsed " << num_statements << " statements, expected " << expected_num_statements << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,157 @@
+// c++ -std=c++17 -O2 -I.. parse_allocations.cpp -o parse_allocations
+//
+// counts the nodes and heap allocations made while parsing each kind of top-level statement
+// the AST is move-only and arena-allocated, so each statement makes exactly one node for each
+// operation, call, if, and loop it has. a regression which reintroduces copies of subtrees
+// makes more, and fails here
+//
+// as at the interpreter's prompt, the parser's arena is reset after each statement, so only the
+// statements which outgrow the memory it kept allocate
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include "../parser.hpp"
+
+namespace
+{
+
+
+std::size_t allocation_count = 0;
+std::size_t allocated_bytes = 0;
+
+
+} // end anonymous namespace
+
+
+// the replacements aren't inlined, so that the compiler doesn't see free() called on the result of operator new
+__attribute__((noinline)) void* operator new(std::size_t size)
+{
+  ++allocation_count;
+  allocated_bytes += size;
+
+  if(void* result = std::malloc(size))
+  {
+    return result;
+  }
+
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  ::operator delete(ptr);
+}
+
+
+std::string generate_program(int num_definitions)
+{
+  std::string result = "extern sin(x);\nextern cos(x);\n";
+
+  for(int i = 0; i < num_definitions; ++i)
+  {
+    std::string name = "helper" + std::string(1, 'a' + i % 26) + std::string(1, 'a' + (i / 26) % 26);
+
+    result += "def " + name + "(x y z)\n";
+    result += "  if x < y then\n";
+    result += "    sin(x) * cos(y) + (x + y) * (z - 1)\n";
+    result += "  else\n";
+    result += "    for i = 0, i < z, 1 in sin(i * x + y);\n";
+    result += name + "(1, 2, 3) + " + name + "(4, 5, 6);\n";
+  }
+
+  return result;
+}
+
+
+// the nodes each kind of statement generate_program() writes should make
+// a definition's body has an if, its condition, seven nodes in its then branch, and five in its loop
+// an expression adds two calls. numbers and variables are stored in their parents, not in nodes of their own
+const std::map<std::string, std::size_t> expected_nodes = {
+  {"function", 14},
+  {"extern", 0},
+  {"expression", 3}
+};
+
+
+int main(int argc, char** argv)
+{
+  int num_definitions = argc > 1 ? std::atoi(argv[1]) : 10000;
+
+  parser p(source_buffer::from_string(generate_program(num_definitions)));
+
+  struct tally
+  {
+    std::size_t statements = 0;
+    std::size_t nodes = 0;
+    std::size_t allocations = 0;
+    std::size_t bytes = 0;
+    std::size_t max_allocations = 0;
+  };
+
+  std::map<std::string, tally> tallies;
+  std::size_t num_failures = 0;
+
+  // silence the parser's chatter
+  std::cout.setstate(std::ios::failbit);
+
+  while(p.current_token() != token(char(EOF)))
+  {
+    if(p.current_token() == token(';'))
+    {
+      p.parse_token(';');
+      continue;
+    }
+
+    std::size_t allocations_before = allocation_count;
+    std::size_t bytes_before = allocated_bytes;
+
+    std::size_t index = p.parse_top_level_statement().index();
+
+    std::size_t allocations = allocation_count - allocations_before;
+    std::size_t bytes = allocated_bytes - bytes_before;
+
+    // the statement no longer refers to its nodes, so the arena is reused for the next one's, as at the prompt
+    std::size_t nodes = p.node_arena().object_count();
+    p.reset_arena();
+
+    const char* kinds[] = {"function", "extern", "expression"};
+    tally& t = tallies[kinds[index]];
+    ++t.statements;
+    t.nodes += nodes;
+    t.allocations += allocations;
+    t.bytes += bytes;
+    t.max_allocations = std::max(t.max_allocations, allocations);
+
+    if(nodes != expected_nodes.at(kinds[index]))
+    {
+      ++num_failures;
+    }
+  }
+
+  std::cout.clear();
+
+  for(const auto& [kind, t] : tallies)
+  {
+    std::cout << kind << ": " << t.statements << " statements, "
+              << double(t.nodes) / t.statements << " nodes/statement (expected " << expected_nodes.at(kind) << "), "
+              << double(t.allocations) / t.statements << " allocations/statement ("
+              << t.max_allocations << " max), "
+              << double(t.bytes) / t.statements << " bytes/statement" << std::endl;
+  }
+
+  if(num_failures)
+  {
+    std::cerr << num_failures << " statements made an unexpected number of nodes" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,82 @@
+// c++ -std=c++17 -O3 -I.. parser_benchmark.cpp -o parser_benchmark
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../parser.hpp"
+
+// generates statements which are each a chain of binary operations over num_terms terms
+std::string generate_operator_chains(std::size_t num_bytes, int num_terms)
+{
+  std::mt19937 rng(num_terms);
+  const char operators[] = {'+', '-', '*', '<'};
+  const char* terms[] = {"x", "y", "1", "2.5", "(x * y)"};
+
+  std::string result;
+  while(result.size() < num_bytes)
+  {
+    result += terms[rng() % 5];
+    for(int i = 1; i < num_terms; ++i)
+    {
+      result += ' ';
+      result += operators[rng() % 4];
+      result += ' ';
+      result += terms[rng() % 5];
+    }
+    result += ";\n";
+  }
+
+  return result;
+}
+
+
+void benchmark_operator_chains(std::size_t num_bytes, int num_terms)
+{
+  std::string program = generate_operator_chains(num_bytes, num_terms);
+
+  parser p(source_buffer::from_string(program));
+
+  // silence the parser's chatter
+  std::cout.setstate(std::ios::failbit);
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  std::size_t num_statements = 0;
+  std::size_t num_nodes = 0;
+  while(p.current_token() != token(char(EOF)))
+  {
+    if(p.current_token() == token(';'))
+    {
+      p.parse_token(';');
+      continue;
+    }
+
+    p.parse_top_level_statement();
+    ++num_statements;
+
+    // free each statement's nodes as interpret() does
+    num_nodes += p.release_arena()->object_count();
+  }
+
+  std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+
+  std::cout.clear();
+  std::cout << num_terms << " terms per statement: "
+            << num_statements << " statements, "
+            << num_nodes / seconds.count() / 1e6 << " Mnodes/s, "
+            << program.size() / seconds.count() / (1 << 20) << " MB/s" << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+  std::size_t num_bytes = argc > 1 ? std::stoul(argv[1]) : 32 << 20;
+
+  for(int num_terms : {2, 10, 100, 1000, 10000})
+  {
+    benchmark_operator_chains(num_bytes, num_terms);
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,108 @@
+// clang -std=c++17 -O2 -I.. pure_call_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// times kernels which repeat calls to a pure function too large to inline, with and
+// without the effect analysis: repeated calls with equal arguments, calls whose results
+// are unused, and calls with loop invariant arguments
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+// kernels report their results to the host, so that their loops can't be deleted
+double total = 0;
+
+extern "C" double sink(double x)
+{
+  total += x;
+  return 0;
+}
+
+// an extern the host promises is pure
+extern "C" double half(double x)
+{
+  return x * 0.5;
+}
+
+const char* kernels = R"(
+  extern sink(x);
+  extern half(x);
+
+  # recursive, so it isn't inlined
+  def fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);
+
+  def repeated(n) for i = 0, i < n in sink(fib(20) + fib(20) * fib(20));
+  def unused(n) for i = 0, i < n in fib(20) + sink(i);
+  def invariant(n y) for i = 0, i < n in sink(i + fib(y));
+  def annotated(n) for i = 0, i < n in sink(half(fib(20)) + half(fib(20)));
+)";
+
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+void report(const char* name, bool infer_effects)
+{
+  codegen_options options;
+  options.infer_effects = infer_effects;
+
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  gen.annotate(intern("half"), function_effects::none());
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    if(const function_prototype* fp = std::get_if<function_prototype>(&statement))
+    {
+      gen.redeclare(*fp);
+      continue;
+    }
+
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  auto repeated = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("repeated").getAddress());
+  auto unused = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("unused").getAddress());
+  auto invariant = reinterpret_cast<double(*)(double, double)>(*compiler.find_symbol("invariant").getAddress());
+  auto annotated = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("annotated").getAddress());
+
+  total = 0;
+
+  std::cout << "  " << name << ":";
+  std::cout << " repeated " << measure([&]{ repeated(1e4); }).count() * 1000 << " ms";
+  std::cout << ", unused " << measure([&]{ unused(1e4); }).count() * 1000 << " ms";
+  std::cout << ", invariant " << measure([&]{ invariant(1e4, 20); }).count() * 1000 << " ms";
+  std::cout << ", annotated extern " << measure([&]{ annotated(1e4); }).count() * 1000 << " ms";
+  std::cout << " (checksum " << total << ")" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  std::cout << "10^4 iterations of each kernel, at O2:" << std::endl;
+
+  report("no attributes  ", false);
+  report("inferred       ", true);
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+// c++ -std=c++17 -O2 -I.. serialization_round_trip.cpp -o serialization_round_trip
+//
+// serializes programs covering every kind of statement and expression, with and
+// without shared subexpressions, loads them back, and checks that the loaded
+// programs serialize to the same bytes and walk to the same nodes. also checks
+// that damaged buffers are rejected rather than read out of bounds
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../parser.hpp"
+#include "../serialization.hpp"
+
+namespace
+{
+
+
+int num_failures = 0;
+
+
+void check(bool condition, const std::string& what)
+{
+  if(!condition)
+  {
+    std::cout << "FAILED: " << what << std::endl;
+    ++num_failures;
+  }
+}
+
+
+program parse(const std::string& text, bool share_subexpressions)
+{
+  parser_options options = parser_options::quiet();
+  options.share_subexpressions = share_subexpressions;
+
+  parser p(source_buffer::from_view(text), options);
+  return p.parse_program();
+}
+
+
+// counts the nodes reachable from a serialized program's statements, visiting shared nodes once per use
+std::size_t count_nodes(const serialized_program& prog)
+{
+  std::size_t result = 0;
+  std::vector<serialized_node> stack;
+  for(std::size_t i = 0; i < prog.num_statements(); ++i)
+  {
+    stack.push_back(prog.statement(i));
+    while(!stack.empty())
+    {
+      serialized_node node = stack.back();
+      stack.pop_back();
+      ++result;
+
+      for(std::size_t j = 0; j < node.num_children(); ++j)
+      {
+        stack.push_back(node.child(j));
+      }
+    }
+  }
+
+  return result;
+}
+
+
+void check_round_trip(const std::string& name, const std::string& text)
+{
+  for(bool share : {false, true})
+  {
+    std::string what = name + (share ? " (shared)" : "");
+
+    program original = parse(text, share);
+    std::string bytes = serialize(original);
+
+    serialized_program loaded = serialized_program::from_bytes(bytes);
+    check(loaded.num_statements() == original.statements().size(), what + ": statement count");
+
+    program converted = loaded.to_program();
+    std::string reserialized = serialize(converted);
+    check(reserialized == bytes, what + ": reserialized bytes differ");
+    check(count_nodes(serialized_program::from_bytes(reserialized)) == count_nodes(loaded), what + ": node count");
+  }
+}
+
+
+template<class Damage>
+void check_rejected(const std::string& name, Damage damage)
+{
+  std::string bytes = serialize(parse("def f(x y) if x < y then f(x + 1, y) else 2.5; extern g(a); g(3);", false));
+  damage(bytes);
+
+  bool rejected = false;
+  try
+  {
+    serialized_program::from_bytes(bytes).to_program();
+  }
+  catch(std::runtime_error&)
+  {
+    rejected = true;
+  }
+
+  check(rejected, name + ": damaged buffer was accepted");
+}
+
+
+} // end anonymous namespace
+
+
+int main()
+{
+  check_round_trip("numbers", "1; 0; 2.5; 1e300; 536870911; 536870912; 0.1 + 0.1;");
+  check_round_trip("variables", "x; y; x;");
+  check_round_trip("binary operations", "def f(x y) x + y * (x - y) < x;");
+  check_round_trip("calls", "extern g(); extern h(a b c); g(); h(1, x, h(2, 3, 4));");
+  check_round_trip("if expressions", "def f(x) if x < 1 then 1 else f(x - 1) * x;");
+  check_round_trip("for expressions", "def f(n) for i = 0, i < n in putchard(42); def g(n) for i = 1, i < n, 2 in i;");
+  check_round_trip("repeated subexpressions", "def f(x y) (x*x + y*y) * (x*x + y*y) - (x*x + y*y); def g(x y) (x*x + y*y) + 1;");
+
+  std::string deep = "def f(x) " + std::string(99999, '(') + "x";
+  for(int i = 0; i < 99999; ++i)
+  {
+    deep += "+1)";
+  }
+  check_round_trip("deep nesting", deep + ";");
+
+  check_rejected("empty", [](std::string& bytes)
+  {
+    bytes.clear();
+  });
+
+  check_rejected("truncated", [](std::string& bytes)
+  {
+    bytes.resize(bytes.size() - 4);
+  });
+
+  check_rejected("bad magic", [](std::string& bytes)
+  {
+    bytes[0] = 'X';
+  });
+
+  check_rejected("newer version", [](std::string& bytes)
+  {
+    bytes[4] += 1;
+  });
+
+  check_rejected("statement refers past the records", [](std::string& bytes)
+  {
+    std::uint32_t offset = bytes.size();
+    std::memcpy(&bytes[sizeof(detail::serialized_header)], &offset, sizeof(offset));
+  });
+
+  if(num_failures == 0)
+  {
+    std::cout << "all round trips passed" << std::endl;
+  }
+
+  return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+// clang -std=c++17 -O2 -I.. specialization_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// times a session of top-level expressions which call definitions with constant arguments,
+// each generated, compiled, and evaluated once, as the interpreter does, with and without
+// specializing the definitions for them, and reports the specializations' hit rate
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+#include "../specialization_modules.hpp"
+
+const char* kernels = R"(
+  # the area under x^2 between a and a + n * h, by the midpoint rule, accumulated in acc
+  # n, a, and h are passed along unchanged, so a specialization for them calls itself
+  def riemann(i n a h acc) if n < i + 1 then acc else riemann(i + 1, n, a, h, acc + (a + (i + 0.5) * h) * (a + (i + 0.5) * h) * h);
+
+  def integrate(a h n) riemann(0, n, a, h, 0);
+
+  def power(x n) if n < 1 then 1 else x * power(x, n - 1);
+)";
+
+// a session which comes back to the same few calls
+const char* expressions = R"(
+  integrate(0, 0.000001, 1000000);
+  integrate(1, 0.000001, 1000000);
+  integrate(0, 0.000001, 1000000);
+  power(1.000001, 1000);
+  integrate(0, 0.000001, 1000000);
+  power(1.000001, 1000);
+)";
+
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+void report(const char* name, const codegen_options& options)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+  specialization_modules specializations;
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  double checksum = 0;
+  std::size_t num_evaluated = 0;
+
+  seconds time = measure([&]
+  {
+    for(int round = 0; round < 10; ++round)
+    {
+      parser session(source_buffer::from_view(expressions), parser_options::quiet());
+      program statements = session.parse_program();
+
+      for(top_level_statement& statement : statements.statements())
+      {
+        function f(function_prototype(intern("__anon_expr"), std::vector<symbol>()), std::move(std::get<expression>(statement)));
+        gen.visitor()(f);
+
+        specializations.update(gen, compiler);
+
+        auto module = compiler.add_module(gen.release_module());
+        checksum += reinterpret_cast<double(*)()>(*compiler.find_symbol("__anon_expr").getAddress())();
+        compiler.remove_module(module);
+        ++num_evaluated;
+      }
+    }
+  });
+
+  specialization_statistics statistics = gen.statistics();
+  std::cout << "  " << name << ": " << num_evaluated << " expressions in " << time.count() * 1000 << " ms"
+            << " (checksum " << checksum << ", "
+            << statistics.num_hits << " hits, "
+            << statistics.num_misses << " misses, "
+            << "hit rate " << statistics.hit_rate() * 100 << "%)" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  report("not specialized     ", codegen_options());
+  report("specialized         ", codegen_options::specialized_calls());
+
+  // as at the interpreter's prompt
+  codegen_options tiered = codegen_options::tiered_compilation();
+  report("tiered              ", tiered);
+
+  tiered.specialize_constant_calls = true;
+  report("tiered, specialized ", tiered);
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+// clang -std=c++17 -O2 -I.. tail_recursion_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes`
+//
+// times recursion which only iterates, with tail calls to itself emitted as calls
+// and as jumps, unoptimized and at O2. recursion as calls is only run as deep as
+// the native stack allows, while jumps are also run a thousand times deeper
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+const char* kernels = R"(
+  # sums 1 through n in an accumulator
+  def sum(n acc) if n < 1 then acc else sum(n - 1, acc + n);
+
+  # Euclid's algorithm by subtraction, which calls itself from both branches of an if
+  def gcd(a b) if a < b then gcd(b, a) else if b < 1 then a else gcd(a - b, b);
+)";
+
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+void report(const char* name, const codegen_options& options, double depth)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  parser p(source_buffer::from_view(kernels), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+  }
+
+  auto sum = reinterpret_cast<double(*)(double, double)>(*compiler.find_symbol("sum").getAddress());
+  auto gcd = reinterpret_cast<double(*)(double, double)>(*compiler.find_symbol("gcd").getAddress());
+
+  double sum_result = 0, gcd_result = 0;
+  seconds sum_time = measure([&]{ sum_result = sum(depth, 0); });
+
+  // about 10^4 subtractions each
+  seconds gcd_time = measure([&]
+  {
+    for(int i = 0; i < 1000; ++i)
+    {
+      gcd_result = gcd(100005, 10);
+    }
+  });
+
+  std::cout << "  " << name << ": sum(" << depth << ") = " << sum_result << " in " << sum_time.count() * 1000 << " ms"
+            << ", gcd(100005, 10) x 1000 = " << gcd_result << " in " << gcd_time.count() * 1000 << " ms" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  for(optimization_level level : {optimization_level::O0, optimization_level::O2})
+  {
+    codegen_options options = codegen_options::with_optimization(level);
+    const char* level_name = level == optimization_level::O0 ? "O0" : "O2";
+
+    options.eliminate_tail_recursion = false;
+    report((std::string(level_name) + ", calls").c_str(), options, 1e5);
+
+    options.eliminate_tail_recursion = true;
+    report((std::string(level_name) + ", jumps").c_str(), options, 1e5);
+    report((std::string(level_name) + ", jumps").c_str(), options, 1e8);
+  }
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+// clang -std=c++17 -O2 -I.. target_setup_benchmark.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit`
+//
+// reports the latency of starting up a generator and a jit_compiler, and of
+// generating, releasing, and compiling one definition at a time, and compares
+// the per-statement latency with the cost of the TargetMachine which each
+// statement used to build before the host's target_context was shared
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  const int num_statements = 1000;
+
+  // the first generator and jit_compiler build the host's target_context
+  seconds first_startup = measure([]
+  {
+    generator gen;
+    jit_compiler compiler;
+  });
+
+  seconds later_startup = measure([]
+  {
+    generator gen;
+    jit_compiler compiler;
+  });
+
+  std::cout << "startup:" << std::endl;
+  std::cout << "  first generator and jit_compiler: " << first_startup.count() * 1000 << " ms" << std::endl;
+  std::cout << "  later generator and jit_compiler: " << later_startup.count() * 1000 << " ms" << std::endl;
+
+  // parse definitions up front, so that only code generation and compilation are timed
+  std::string text;
+  for(int i = 0; i < num_statements; ++i)
+  {
+    text += "def f" + std::string(1, 'a' + i % 26) + std::string(1, 'a' + i / 26 % 26) + std::string(1, 'a' + i / 676) + "(x y) (x + y) * (x - y) + " + std::to_string(i) + ";\n";
+  }
+
+  parser p(source_buffer::from_view(text), parser_options::quiet());
+  program prog = p.parse_program();
+
+  generator gen;
+  jit_compiler compiler;
+
+  seconds per_statement = measure([&]
+  {
+    for(const top_level_statement& statement : prog.statements())
+    {
+      gen.visitor()(std::get<function>(statement));
+      compiler.add_module(gen.release_module());
+    }
+  }) / num_statements;
+
+  // what each release_module() used to pay before the target was shared
+  seconds rebuilt_target = measure([]
+  {
+    for(int i = 0; i < num_statements; ++i)
+    {
+      std::unique_ptr<llvm::TargetMachine> target_machine(llvm::EngineBuilder().selectTarget());
+      target_machine->createDataLayout();
+    }
+  }) / num_statements;
+
+  std::cout << "per statement:" << std::endl;
+  std::cout << "  generate, release, and compile with the shared target: " << per_statement.count() * 1e6 << " us" << std::endl;
+  std::cout << "  building a TargetMachine for each module's data layout: " << rebuilt_target.count() * 1e6 << " us" << std::endl;
+
+  return 0;
+}
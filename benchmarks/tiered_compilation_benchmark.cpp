@@ -0,0 +1,105 @@
+// clang -std=c++17 -O2 -I.. tiered_compilation_benchmark.cpp -lstdc++ -rdynamic -pthread `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes bitreader bitwriter`
+//
+// compares compiling every definition with the full pipeline against tiered
+// compilation: the latency of defining many functions which are called once,
+// and the time of repeated calls to a hot function as it is recompiled
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+std::string generate_definitions(int num_definitions)
+{
+  std::string result;
+  for(int i = 0; i < num_definitions; ++i)
+  {
+    std::string name = "helper";
+    for(int n = i; n > 0; n /= 26)
+    {
+      name += 'a' + n % 26;
+    }
+
+    result += "def " + name + "(x y) if x < y then (x + y) * (x - y) else for i = 0, i < x in x * y + " + std::to_string(i) + ";\n";
+  }
+
+  return result;
+}
+
+
+void define(generator& gen, jit_compiler& compiler, const std::string& text)
+{
+  parser p(source_buffer::from_view(text), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+    compiler.add_module(gen.release_module());
+
+    // the interpreter compiles each definition before it reads the next
+    compiler.find_symbol(std::get<function>(statement).prototype().name().str()).getAddress();
+  }
+}
+
+
+void report(const char* name, const codegen_options& options)
+{
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  const int num_definitions = 1000;
+  seconds definition_latency = measure([&]
+  {
+    define(gen, compiler, generate_definitions(num_definitions));
+  }) / num_definitions;
+
+  define(gen, compiler, "def fib(x) if x < 3 then 1 else fib(x - 1) + fib(x - 2);");
+
+  std::cout << "  " << name << ": " << definition_latency.count() * 1e6 << " us per definition; fib(25) x 10 batches:";
+
+  for(int batch = 0; batch < 10; ++batch)
+  {
+    // look fib up each time, as the interpreter does, so calls go through its stub
+    auto fib = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("fib").getAddress());
+    std::cout << " " << measure([&]{ fib(25); }).count() * 1000;
+
+    // give the background thread a moment to switch fib over
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+
+  jit_statistics statistics = compiler.statistics();
+  std::cout << " ms (tier " << compiler.tier("fib") << "; "
+            << statistics.num_first_tier_compiles << " first-tier compiles, "
+            << statistics.num_tier_up_requests << " tier-up requests, "
+            << statistics.num_recompiled << " recompiled, "
+            << statistics.num_discarded << " discarded)" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  report("O2, eager ", codegen_options::with_optimization(optimization_level::O2));
+  report("O2, tiered", codegen_options::tiered_compilation());
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+// c++ -std=c++17 -O3 -I.. visit_benchmark.cpp -o visit_benchmark
+//
+// measures the cost per node of dispatching on expressions with visit's switch
+// against std::visit, which visit used before, by folding over realistic trees
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include "../parser.hpp"
+#include "../walk.hpp"
+
+// generates function definitions like a hand-written program's: mostly arithmetic
+// over variables and numbers, with some calls and conditionals
+std::string generate_definitions(std::size_t num_bytes)
+{
+  std::mt19937 rng(0);
+  const char operators[] = {'+', '-', '*', '<'};
+
+  std::function<std::string(int)> generate_expression = [&](int depth) -> std::string
+  {
+    unsigned int choice = rng() % 16;
+    if(depth > 4 or choice < 5)
+    {
+      const char* leaves[] = {"x", "y", "z", "1", "0.5"};
+      return leaves[rng() % 5];
+    }
+    else if(choice < 13)
+    {
+      return "(" + generate_expression(depth + 1) + " " + operators[rng() % 4] + " " + generate_expression(depth + 1) + ")";
+    }
+    else if(choice < 15)
+    {
+      return "f(" + generate_expression(depth + 1) + ", " + generate_expression(depth + 1) + ")";
+    }
+
+    return "if " + generate_expression(depth + 1) + " then " + generate_expression(depth + 1) + " else " + generate_expression(depth + 1);
+  };
+
+  std::string result = "extern f(a b);\n";
+  while(result.size() < num_bytes)
+  {
+    result += "def g(x y z) " + generate_expression(0) + "\n";
+  }
+
+  return result;
+}
+
+
+// folds an expression into a number, dispatching on each node with Dispatch
+template<class Dispatch>
+struct fold
+{
+  double operator()(const number& node) const
+  {
+    return node.value();
+  }
+
+  double operator()(const variable& node) const
+  {
+    return node.name().id();
+  }
+
+  double operator()(const binary_operation& node) const
+  {
+    return Dispatch()(*this, node.lhs()) + Dispatch()(*this, node.rhs()) + node.op();
+  }
+
+  double operator()(const call& node) const
+  {
+    double result = 0;
+    for(const expression& argument : node.arguments())
+    {
+      result += Dispatch()(*this, argument);
+    }
+
+    return result;
+  }
+
+  double operator()(const if_expression& node) const
+  {
+    return Dispatch()(*this, node.condition()) + Dispatch()(*this, node.then_expression()) + Dispatch()(*this, node.else_expression());
+  }
+
+  double operator()(const for_expression& node) const
+  {
+    return Dispatch()(*this, node.body());
+  }
+};
+
+
+struct switch_dispatch
+{
+  template<class Visitor>
+  double operator()(const Visitor& visitor, const expression& e) const
+  {
+    return ::visit(visitor, e);
+  }
+};
+
+
+struct std_visit_dispatch
+{
+  template<class Visitor>
+  double operator()(const Visitor& visitor, const expression& e) const
+  {
+    // how visit dispatched before it switched on the index
+    detail::unwrap_and_call<Visitor> unwrapping_visitor{visitor};
+    return std::visit(unwrapping_visitor, detail::super(e));
+  }
+};
+
+
+template<class Dispatch>
+void report(const char* name, const std::vector<const expression*>& bodies, std::size_t num_nodes)
+{
+  const int num_repetitions = 20;
+
+  double checksum = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for(int i = 0; i < num_repetitions; ++i)
+  {
+    for(const expression* body : bodies)
+    {
+      checksum += Dispatch()(fold<Dispatch>(), *body);
+    }
+  }
+
+  std::chrono::duration<double, std::nano> nanoseconds = std::chrono::high_resolution_clock::now() - start;
+
+  std::cout << "  " << name << ": " << nanoseconds.count() / (num_repetitions * num_nodes) << " ns/node"
+            << " (checksum " << checksum << ")" << std::endl;
+}
+
+
+int main()
+{
+  std::string text = generate_definitions(16 << 20);
+
+  parser p(source_buffer::from_view(text), parser_options::quiet());
+  program prog = p.parse_program();
+
+  std::vector<const expression*> bodies;
+  std::size_t num_nodes = 0;
+  for(const top_level_statement& statement : prog.statements())
+  {
+    if(const function* f = std::get_if<function>(&statement))
+    {
+      bodies.push_back(&f->body());
+    }
+  }
+
+  for(const expression* body : bodies)
+  {
+    for_each_subexpression(*body, [&](const expression&)
+    {
+      ++num_nodes;
+    });
+  }
+
+  std::cout << bodies.size() << " definitions, " << num_nodes << " nodes:" << std::endl;
+
+  report<std_visit_dispatch>("std::visit", bodies, num_nodes);
+  report<switch_dispatch>("switch", bodies, num_nodes);
+
+  return 0;
+}
+
@@ -0,0 +1,124 @@
+// clang -std=c++17 -O2 -I.. whole_program_benchmark.cpp -lstdc++ -rdynamic -pthread `llvm-config --cppflags --ldflags --system-libs --libs core native orcjit passes bitreader bitwriter linker`
+//
+// runs a program built from small helpers, which only pay off when they're inlined:
+// compiled one module per definition, as one internalized module, and tiered at the
+// REPL with and without linking a hot function's callees into its recompilation
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <llvm/Support/TargetSelect.h>
+#include "../parser.hpp"
+#include "../generator.hpp"
+#include "../jit_compiler.hpp"
+
+const char* helpers = R"(
+  def sq(x) x*x;
+  def add(x y) x + y;
+  def norm2(x y) add(sq(x), sq(y));
+  def step(x) norm2(x * 0.001, 1 - x * 0.001);
+  def run(n) for i = 0, i < n in step(i);
+)";
+
+using seconds = std::chrono::duration<double>;
+
+
+template<class Function>
+seconds measure(Function f)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+
+// generates each definition into the generator's module, releasing a module after each one unless whole_program
+void generate(generator& gen, jit_compiler& compiler, bool whole_program)
+{
+  parser p(source_buffer::from_view(helpers), parser_options::quiet());
+  program prog = p.parse_program();
+
+  for(const top_level_statement& statement : prog.statements())
+  {
+    gen.visitor()(std::get<function>(statement));
+
+    if(!whole_program)
+    {
+      compiler.add_module(gen.release_module());
+    }
+  }
+
+  if(whole_program)
+  {
+    gen.internalize([](llvm::StringRef name)
+    {
+      return name == "run";
+    });
+
+    compiler.add_module(gen.release_module());
+  }
+}
+
+
+void report_eager(const char* name, bool whole_program)
+{
+  generator gen;
+  jit_compiler compiler;
+
+  double (*run)(double) = nullptr;
+  seconds compile_time = measure([&]
+  {
+    generate(gen, compiler, whole_program);
+    run = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("run").getAddress());
+  });
+
+  std::cout << "  " << name << ": compile " << compile_time.count() * 1000 << " ms";
+  std::cout << ", run(10^7) " << measure([&]{ run(1e7); }).count() * 1000 << " ms" << std::endl;
+}
+
+
+void report_tiered(const char* name, bool relink)
+{
+  codegen_options options = codegen_options::tiered_compilation();
+  options.relink_hot_call_graph = relink;
+
+  // run is only called a few times below, while its callees are called thousands of times
+  options.tier_up_threshold = 10;
+
+  target_context target(options);
+  generator gen(target);
+  jit_compiler compiler(target);
+
+  generate(gen, compiler, false);
+
+  // warm up with short runs until the background thread has recompiled run
+  for(int i = 0; i < 100 and compiler.tier("run") < 1; ++i)
+  {
+    auto run = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("run").getAddress());
+    run(1e4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  auto run = reinterpret_cast<double(*)(double)>(*compiler.find_symbol("run").getAddress());
+
+  jit_statistics statistics = compiler.statistics();
+  std::cout << "  " << name << ": run(10^7) " << measure([&]{ run(1e7); }).count() * 1000 << " ms"
+            << " (tier " << compiler.tier("run") << "; "
+            << statistics.num_recompiled << " recompiled, "
+            << statistics.num_discarded << " discarded)" << std::endl;
+}
+
+
+int main()
+{
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  report_eager("module per definition", false);
+  report_eager("whole program        ", true);
+  report_tiered("tiered              ", false);
+  report_tiered("tiered, relinked    ", true);
+
+  return 0;
+}
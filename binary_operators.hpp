@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+enum class associativity : std::uint8_t
+{
+  left,
+  right
+};
+
+
+struct binary_operator_info
+{
+  // characters which aren't binary operators have negative precedence
+  std::int8_t precedence;
+  associativity assoc;
+
+  constexpr bool is_binary_operator() const
+  {
+    return precedence >= 0;
+  }
+};
+
+
+// a binary_operator_table maps each character to its binary_operator_info
+// it is indexed directly by character, so lookup is a single load
+class binary_operator_table
+{
+  public:
+    constexpr binary_operator_table()
+      : entries_{}
+    {
+      for(auto& entry : entries_)
+      {
+        entry = {-1, associativity::left};
+      }
+    }
+
+    // returns a copy of this table with op registered
+    constexpr binary_operator_table with(char op, std::int8_t precedence, associativity assoc = associativity::left) const
+    {
+      binary_operator_table result = *this;
+      result.entries_[static_cast<unsigned char>(op)] = {precedence, assoc};
+      return result;
+    }
+
+    constexpr const binary_operator_info& operator[](char op) const
+    {
+      return entries_[static_cast<unsigned char>(op)];
+    }
+
+  private:
+    binary_operator_info entries_[256];
+};
+
+
+// the binary operators understood by the parser
+// to add an operator, register it here and teach generator how to lower it
+constexpr binary_operator_table binary_operators = binary_operator_table()
+  .with('<', 10)
+  .with('+', 20)
+  .with('-', 20)
+  .with('*', 40)
+;
+
+
+static_assert(binary_operators['*'].precedence > binary_operators['+'].precedence);
+static_assert(!binary_operators['('].is_binary_operator());
+
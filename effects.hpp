@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cmath>
+#include "syntax.hpp"
+#include "walk.hpp"
+
+// what calling a function may do besides computing its result
+//
+// Kaleidoscope functions only compute with doubles, so a function's only
+// effects are those of the host functions it calls through externs, and
+// whether it returns at all
+struct function_effects
+{
+  // reads and writes no memory, and throws nothing, so calls with equal arguments may be
+  // merged, and calls whose results are unused may be deleted
+  bool pure = false;
+
+  // returns for every argument, so that a pure call may be made before it is known to be needed
+  bool terminates = false;
+
+  // what an extern, or a function which calls one, may do
+  static function_effects unknown()
+  {
+    return function_effects();
+  }
+
+  // what arithmetic does
+  static function_effects none()
+  {
+    function_effects result;
+    result.pure = true;
+    result.terminates = true;
+    return result;
+  }
+
+  // whether a caller which expected these effects may call a function with other's
+  bool allows(const function_effects& other) const
+  {
+    return (other.pure or !pure) and (other.terminates or !terminates);
+  }
+};
+
+
+// a loop is known to terminate when it counts from a number to a number by a step of at least 1,
+// small enough that adding the step always changes the loop variable
+inline bool is_bounded_loop(const for_expression& node)
+{
+  auto is_small_number = [](const expression& e, double least)
+  {
+    const number* n = ::get_if<number>(&e);
+    return n and n->value() >= least and std::fabs(n->value()) <= 0x1p52;
+  };
+
+  if(node.step() and !is_small_number(*node.step(), 1))
+  {
+    return false;
+  }
+
+  const binary_operation* condition = ::get_if<binary_operation>(&node.end());
+  if(!condition or condition->op() != '<')
+  {
+    return false;
+  }
+
+  const variable* loop_variable = ::get_if<variable>(&condition->lhs());
+
+  return loop_variable and loop_variable->name() == node.loop_variable_name() and
+         is_small_number(node.begin(), -0x1p52) and
+         is_small_number(condition->rhs(), -0x1p52);
+}
+
+
+// returns the effects of calling f, given effects_of_callee, which returns the effects of each function f calls
+// a function which calls itself is as pure as the rest of its body, but may not terminate
+template<class Function>
+function_effects effects_of(const function& f, Function effects_of_callee)
+{
+  function_effects result = function_effects::none();
+
+  for_each_subexpression(f.body(), [&](const expression& e)
+  {
+    if(const call* c = ::get_if<call>(&e))
+    {
+      if(c->callee_name() == f.prototype().name())
+      {
+        result.terminates = false;
+      }
+      else
+      {
+        function_effects callee = effects_of_callee(c->callee_name());
+        result.pure = result.pure and callee.pure;
+        result.terminates = result.terminates and callee.terminates;
+      }
+    }
+    else if(const for_expression* loop = ::get_if<for_expression>(&e))
+    {
+      result.terminates = result.terminates and is_bounded_loop(*loop);
+    }
+  });
+
+  return result;
+}
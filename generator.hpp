@@ -1,56 +1,265 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Verifier.h>
-#include <llvm/IR/LegacyPassManager.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Scalar/GVN.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include "effects.hpp"
 #include "syntax.hpp"
+#include "target.hpp"
+#include "optimizer.hpp"
+#include "tiering.hpp"
+#include "memoization.hpp"
+#include "serialization.hpp"
+
+// each specialization of a function is named after it, with this infix and a number
+constexpr const char* specialization_infix = ".spec.";
+
+
+// how often calls with constant arguments found a specialization of their callee to reuse
+struct specialization_statistics
+{
+  // calls which reused a specialization, and calls which generated one
+  std::size_t num_hits = 0;
+  std::size_t num_misses = 0;
+
+  // specializations forgotten because a function was defined or declared again
+  std::size_t num_invalidated = 0;
+
+  double hit_rate() const
+  {
+    std::size_t num_calls = num_hits + num_misses;
+    return num_calls ? double(num_hits) / num_calls : 0;
+  }
+};
+
+
+// a module of specializations released by a generator, and the generation of the cache they were generated for
+// invalidating the cache starts a new generation, after which nothing calls the older modules' specializations
+struct specialization_module
+{
+  std::unique_ptr<llvm::Module> module;
+  std::size_t generation = 0;
+
+  explicit operator bool() const
+  {
+    return module != nullptr;
+  }
+};
+
 
 class generator
 {
+  private:
+    // where a binary operation's value was computed
+    struct shared_value
+    {
+      llvm::Value* value;
+      llvm::BasicBlock* block;
+    };
+
+    // when the parser shares equal subtrees, a binary operation may appear several times in a function
+    using shared_value_map = std::unordered_map<const binary_operation*, shared_value>;
+
+    // what the generator knows about a function which may be called
+    struct declared_function
+    {
+      std::size_t num_parameters;
+
+      // what calling the function may do, which its callers are optimized for
+      function_effects effects;
+
+      // the functions whose calls to it were generated, other than itself and anonymous expressions,
+      // which were optimized for its effects when it was pure
+      std::vector<symbol> callers;
+    };
+
+    // each function which may be called, by name
+    using prototype_map = symbol_map<std::optional<declared_function>>;
+
+    // the loop a tail recursive function's calls to itself jump to, and the phis of its parameters
+    struct tail_recursion_state
+    {
+      llvm::BasicBlock* loop_block = nullptr;
+      std::vector<llvm::PHINode*> parameters;
+    };
+
+    // a call's constant arguments, as bit patterns so that -0.0 and 0.0 differ, and nothing for the others
+    using constant_arguments = std::vector<std::optional<std::uint64_t>>;
+
+    // the specializations of functions for the constant arguments they've been called with
+    struct specialization_cache
+    {
+      // the name of each function's specialization for each set of constant arguments
+      std::map<std::pair<symbol, constant_arguments>, symbol> specializations;
+
+      // where specializations are generated, so that they outlive the module which first called them
+      std::unique_ptr<llvm::Module> module;
+
+      // how many specializations have been named
+      std::size_t num_named = 0;
+
+      // how many times the specializations have been forgotten
+      std::size_t generation = 0;
+
+      specialization_statistics statistics;
+
+      // a specialization may have inlined any function it calls, so when one function changes, all are forgotten,
+      // including those which haven't been released yet
+      void invalidate()
+      {
+        statistics.num_invalidated += specializations.size();
+        specializations.clear();
+        ++generation;
+
+        for(llvm::Function& f : *module)
+        {
+          f.deleteBody();
+        }
+
+        while(!module->empty())
+        {
+          module->begin()->eraseFromParent();
+        }
+
+        while(!module->global_empty())
+        {
+          module->global_begin()->eraseFromParent();
+        }
+      }
+    };
+
   public:
-    generator()
-      : context_(),
+    explicit generator(target_context& target = target_context::host())
+      : target_(&target),
+        context_(),
         builder_(context_),
-        module_(make_module(context_)),
-        function_pass_manager_(make_function_pass_manager(*module_))
-    {}
+        module_(make_module()),
+        optimizer_(std::make_unique<optimizer>(target))
+    {
+      specializations_.module = make_module();
+
+      // the visitor's floating point instructions are emitted with the target's fast-math flags
+      builder_.setFastMathFlags(target.options().fast_math_flags());
+    }
 
     std::unique_ptr<llvm::Module> release_module()
     {
       // create a new module
-      std::unique_ptr<llvm::Module> old_module = make_module(context_);
+      // functions in other modules are declared in it when they're first called, from the prototypes seen so far
+      std::unique_ptr<llvm::Module> old_module = make_module();
       std::swap(old_module, module_);
 
-      // make a function pass manager for the new module
-      function_pass_manager_ = make_function_pass_manager(*module_);
+      optimizer_->optimize(*old_module);
+
+      // return the old module
+      return old_module;
+    }
+
+    // returns the module of the specializations generated since the last call, or no module when there are none
+    // it must be added to the jit_compiler before the module which called them, and kept while later modules may
+    // call them too, which is until specialization_generation() has moved past its generation
+    specialization_module release_specializations()
+    {
+      bool has_definitions = std::any_of(specializations_.module->begin(), specializations_.module->end(), [](const llvm::Function& f)
+      {
+        return !f.isDeclaration();
+      });
+
+      if(!has_definitions)
+      {
+        return {};
+      }
+
+      specialization_module result{make_module(), specializations_.generation};
+      std::swap(result.module, specializations_.module);
+
+      optimizer_->optimize(*result.module);
+
+      return result;
+    }
+
+    // the generation of the specializations which may still be called
+    std::size_t specialization_generation() const
+    {
+      return specializations_.generation;
+    }
+
+    specialization_statistics statistics() const
+    {
+      return specializations_.statistics;
+    }
 
-      // copy function declarations from the old module into the new
-      // so that we can call functions in other modules from the new one
-      for(auto& f : old_module->functions())
+    // gives the current module's definitions which is_exported rejects internal linkage, so that
+    // the module pipeline may inline them into their callers, specialize them, and discard them
+    // the module should hold every caller of such definitions when it is released
+    template<class Predicate>
+    void internalize(Predicate is_exported)
+    {
+      for(llvm::Function& f : *module_)
       {
-        // get the function's parameter names
-        std::vector<std::string> parameter_names;
-        for(auto& arg : f.args())
+        if(!f.isDeclaration() and !is_exported(f.getName()))
         {
-          parameter_names.push_back(arg.getName());
+          f.setLinkage(llvm::GlobalValue::InternalLinkage);
+
+          // internal functions can't be called from other modules, nor from their specializations
+          prototypes_[intern(f.getName().str())].reset();
+          definitions_[intern(f.getName().str())].reset();
         }
+      }
+    }
+
+    // promises that the host function name, which programs may declare with extern, has only the given effects
+    // this should be done before the function is first declared
+    void annotate(symbol name, const function_effects& effects)
+    {
+      host_effects_[name] = effects;
+    }
 
-        // create a function prototype
-        function_prototype prototype(f.getName(), parameter_names);
+    // declares prototype's function in the current module
+    // a declaration of the same name with a different number of parameters is replaced,
+    // so that a function's signature may change when it is redefined
+    // what was known of the function's effects is forgotten, so it may be redefined with any, and
+    // the caller is responsible for regenerating functions which called it
+    llvm::Function& redeclare(const function_prototype& prototype)
+    {
+      prototypes_[prototype.name()] = declared_function{prototype.parameters().size(), host_effects_[prototype.name()], {}};
 
-        // visit the prototype to declare these functions in the new module
-        visitor()(prototype);
+      // the function is no longer the one which was specialized, or which may be generated again
+      if(definitions_[prototype.name()])
+      {
+        definitions_[prototype.name()].reset();
+        specializations_.invalidate();
       }
 
-      // return the old module
-      return old_module;
+      if(llvm::Function* existing = module_->getFunction(prototype.name().str()))
+      {
+        if(existing->arg_size() == prototype.parameters().size())
+        {
+          return *existing;
+        }
+
+        if(!existing->empty() or !existing->use_empty())
+        {
+          throw std::runtime_error("Function redefined with a different number of parameters");
+        }
+
+        existing->eraseFromParent();
+      }
+
+      return visitor()(prototype);
     }
 
     class visitor_type
@@ -65,69 +274,113 @@ class generator
 
         llvm::Value& operator()(const variable& node) const
         {
-          if(named_values_.count(node.name()) == 0)
+          llvm::Value* result = named_values_[node.name()];
+          if(!result)
           {
-            throw std::runtime_error(std::string("No variable named '") + node.name() + "'");
+            throw std::runtime_error(std::string("No variable named '") + node.name().str() + "'");
           }
 
-          return *named_values_[node.name()];
+          return *result;
         }
 
         llvm::Value& operator()(const binary_operation& node) const
         {
           using namespace llvm;
 
-          // visit both sides of the operation
-          Value& lhs = visit<Value&>(*this, node.lhs());
-          Value& rhs = visit<Value&>(*this, node.rhs());
-
-          // emit the appropriate instruction
-          Value* result = nullptr;
-          switch(node.op())
+          if(tail_position_)
           {
-            case '+':
-            {
-              result = builder_.CreateFAdd(&lhs, &rhs, "addtmp");
-              break;
-            }
-
-            case '-':
-            {
-              result = builder_.CreateFSub(&lhs, &rhs, "subtmp");
-              break;
-            }
+            return without_tail_position()(node);
+          }
 
-            case '*':
-            {
-              result = builder_.CreateFMul(&lhs, &rhs, "multmp");
-              break;
-            }
+          // chains of binary operations may be far deeper than the native stack,
+          // so walk them with an explicit stack of work items, left to right
+          struct work_item
+          {
+            enum {visit_operand, expand_operation, emit_operation} action;
+            const expression* operand;
+            const binary_operation* operation;
+          };
+
+          // an operand is pure when it is computed only from numbers, variables, and
+          // binary operations, so that it may be reused wherever it is available
+          struct operand_value
+          {
+            Value* value;
+            bool pure;
+          };
 
-            case '<':
-            {
-              // create the result of the comparison
-              Value* compare_result = builder_.CreateFCmpULT(&lhs, &rhs, "cmptmp");
+          std::vector<work_item> work{{work_item::expand_operation, nullptr, &node}};
+          std::vector<operand_value> values;
 
-              // convert the unsigned integer result to floating point
-              result = builder_.CreateUIToFP(compare_result, Type::getDoubleTy(context_), "booltmp");
-              break;
-            }
+          while(!work.empty())
+          {
+            work_item item = work.back();
+            work.pop_back();
 
-            default:
+            switch(item.action)
             {
-              throw std::runtime_error("Invalid binary operator");
+              case work_item::visit_operand:
+              {
+                if(const binary_operation* operation = ::get_if<binary_operation>(item.operand))
+                {
+                  work.push_back({work_item::expand_operation, nullptr, operation});
+                }
+                else
+                {
+                  bool pure = ::get_if<number>(item.operand) or ::get_if<variable>(item.operand);
+                  values.push_back({&visit<Value&>(*this, *item.operand), pure});
+                }
+
+                break;
+              }
+
+              case work_item::expand_operation:
+              {
+                // a shared subtree which was already computed in this block needn't be computed again
+                // variables can only be rebound in a new block, so the value is still current
+                auto shared = shared_values_.find(item.operation);
+                if(shared != shared_values_.end() and shared->second.block == builder_.GetInsertBlock())
+                {
+                  values.push_back({shared->second.value, true});
+                  break;
+                }
+
+                // items are popped in reverse, so the lhs is visited first and the operation emitted last
+                work.push_back({work_item::emit_operation, nullptr, item.operation});
+                work.push_back({work_item::visit_operand, &item.operation->rhs(), nullptr});
+                work.push_back({work_item::visit_operand, &item.operation->lhs(), nullptr});
+                break;
+              }
+
+              case work_item::emit_operation:
+              {
+                operand_value rhs = values.back();
+                values.pop_back();
+
+                operand_value lhs = values.back();
+                values.pop_back();
+
+                operand_value result{&emit_binary_operation(item.operation->op(), *lhs.value, *rhs.value), lhs.pure and rhs.pure};
+                if(result.pure)
+                {
+                  shared_values_[item.operation] = {result.value, builder_.GetInsertBlock()};
+                }
+
+                values.push_back(result);
+                break;
+              }
             }
           }
 
-          return *result;
+          return *values.back().value;
         }
 
         llvm::Value& operator()(const if_expression& node) const
         {
           using namespace llvm;
 
-          // visit the if's condition
-          Value& condition = visit<Value&>(*this, node.condition());
+          // visit the if's condition, which is never in tail position, unlike the branches
+          Value& condition = visit<Value&>(without_tail_position(), node.condition());
 
           // convert the condition into a bool by comparing non-equal to 0.0
           Value* bool_condition = builder_.CreateFCmpONE(&condition, ConstantFP::get(context_, APFloat(0.0)), "ifcond");
@@ -167,96 +420,47 @@ class generator
 
         llvm::Value& operator()(const for_expression& node) const
         {
-          using namespace llvm;
-
-          // visit the begin expression first
-          Value& begin_value = visit<Value&>(*this, node.begin());
-
-          // create a basic block for the loop body,
-          // after the current function's current block
-          BasicBlock* pre_loop_block = builder_.GetInsertBlock();
-          Function* current_function = pre_loop_block->getParent();
-          BasicBlock* loop_body_block = BasicBlock::Create(context_, "loop", current_function);
-
-          // insert an explicit branch from the pre_loop_blocko the loop_body_block
-          builder_.CreateBr(loop_body_block);
-
-          // begin inserting IR into the loop body
-          builder_.SetInsertPoint(loop_body_block);
-
-          // create the loop variable, which takes its value from a phi node
-          PHINode& loop_variable = *builder_.CreatePHI(Type::getDoubleTy(context_), 2, node.loop_variable_name());
-          loop_variable.addIncoming(&begin_value, pre_loop_block);
-
-          // shadow any variable in the outer scope with the same name as the loop variable
-          Value* shadowed_variable = nullptr;
-          if(named_values_.count(node.loop_variable_name()))
+          if(tail_position_)
           {
-            shadowed_variable = named_values_[node.loop_variable_name()];
+            return without_tail_position()(node);
           }
 
-          // map the loop variable name to its value
-          named_values_[node.loop_variable_name()] = &loop_variable;
-
-          // generate code for the loop body
-          visit<Value&>(*this, node.body());
-
-          // generate code for the loop step
-          Value& step_value = node.step()
-            ? visit<Value&>(*this, *node.step())
-            : *ConstantFP::get(context_, APFloat(1.0))
-          ;
-
-          // add the step to the loop variable to create its next value
-          Value& next_value_of_loop_variable = *builder_.CreateFAdd(&loop_variable, &step_value, "nextvar");
-
-          // generate the end value
-          Value& end_value = visit<Value&>(*this, node.end());
-
-          // convert the end value to a boolean
-          Value& end_condition = *builder_.CreateFCmpONE(&end_value, ConstantFP::get(context_, APFloat(0.0)), "loopcond");
-
-          // note the block which ends the loop
-          BasicBlock* loop_end_block = builder_.GetInsertBlock();
-
-          // hook up the loop variable node to the next iteration's value
-          loop_variable.addIncoming(&next_value_of_loop_variable, loop_end_block);
-
-          // create the block following the loop body
-          BasicBlock* post_loop_block = BasicBlock::Create(context_, "postloop", current_function);
-
-          // create the branch at the end of the loop
-          builder_.CreateCondBr(&end_condition, loop_body_block, post_loop_block);
-
-          // point the builder at the block following the loop
-          builder_.SetInsertPoint(post_loop_block);
-
-          // restore the shadowed variable
-          if(shadowed_variable)
+          // loops which count up to a bound are lowered to a loop with an integer trip count,
+          // which LLVM's loop passes can unroll and vectorize
+          if(!generic_loops_ and target_.options().counted_loops)
           {
-            named_values_[node.loop_variable_name()] = shadowed_variable;
+            std::int64_t step = 0;
+            if(const expression* bound = counted_loop_bound(node, step))
+            {
+              return emit_counted_loop(node, *bound, step);
+            }
           }
 
-          // loop expressions always return 0.0
-          return *ConstantFP::get(context_, APFloat(0.0));
+          // visit the begin expression first
+          llvm::Value& begin_value = visit<llvm::Value&>(*this, node.begin());
+
+          return emit_loop(node, begin_value);
         }
 
         llvm::Function& operator()(const function_prototype& node) const
         {
           using namespace llvm;
 
-          // create the function's type
-          std::vector<Type*> parameter_types(node.parameters().size(), Type::getDoubleTy(context_));
-          FunctionType* function_type = FunctionType::get(Type::getDoubleTy(context_), parameter_types, false);
+          // later modules declare the function from its prototype when they call it
+          // another declaration of the same function doesn't change what is known of it
+          std::optional<declared_function>& declared = prototypes_[node.name()];
+          if(!declared or declared->num_parameters != node.parameters().size())
+          {
+            declared = declared_function{node.parameters().size(), host_effects_[node.name()], {}};
+          }
 
-          // create the function
-          Function& result = *Function::Create(function_type, Function::ExternalLinkage, node.name(), &module_);
+          Function& result = declare(node.name(), *declared);
 
           // name the function's arguments
           int i = 0;
           for(auto& arg : result.args())
           {
-            arg.setName(node.parameters()[i]);
+            arg.setName(node.parameters()[i].str());
             ++i;
           }
 
@@ -267,11 +471,30 @@ class generator
         {
           using namespace llvm;
 
-          // look up the callee
-          Function* callee = module_.getFunction(node.callee_name());
+          // look up the callee, declaring it if it's the first call to a function of another module
+          std::optional<declared_function>& declared = prototypes_[node.callee_name()];
+          Function* callee = module_.getFunction(node.callee_name().str());
           if(!callee)
           {
-            throw std::runtime_error("Could not find function");
+            if(!declared)
+            {
+              throw std::runtime_error("Could not find function");
+            }
+
+            callee = &declare(node.callee_name(), *declared);
+          }
+
+          // a recursive call can't outlive its caller's definition, so it doesn't constrain the next one,
+          // and neither do anonymous expressions and specializations, which are never called again once it's redefined
+          // first-tier declarations have no attributes, so first-tier calls aren't optimized for the callee's effects
+          Function& caller = *builder_.GetInsertBlock()->getParent();
+          if(!target_.options().tiered and declared and declared->effects.pure and callee != &caller and !is_anonymous(caller.getName()) and &module_ != specializations_.module.get())
+          {
+            symbol caller_name = intern(std::string_view(caller.getName().data(), caller.getName().size()));
+            if(std::find(declared->callers.begin(), declared->callers.end(), caller_name) == declared->callers.end())
+            {
+              declared->callers.push_back(caller_name);
+            }
           }
 
           // check the call's arguments and type
@@ -280,15 +503,47 @@ class generator
             throw std::runtime_error("Incorrect number of arguments");
           }
 
-          // visit each argument
+          // a call with constant arguments may call a copy of its callee specialized for them instead
+          // a recursive call can't be specialized, since the definition being generated isn't the one which was kept
+          // only anonymous expressions, and the specializations they call, are never called again once a function
+          // they specialized is redefined, so other functions keep calling their callees by name
+          constant_arguments constants;
+          Function* specialization = nullptr;
+          bool specializable_caller = is_anonymous(caller.getName()) or &module_ == specializations_.module.get();
+          if(target_.options().specialize_constant_calls and specializable_caller and callee != &caller)
+          {
+            constants = constant_arguments_of(node);
+            specialization = specialize(node.callee_name(), *callee, constants);
+          }
+
+          if(specialization)
+          {
+            callee = specialization;
+          }
+
+          // visit each argument, except the constants a specialization already has
           std::vector<Value*> arguments;
-          for(const auto& arg_expression : node.arguments())
+          for(std::size_t i = 0; i < node.arguments().size(); ++i)
+          {
+            if(!specialization or !constants[i])
+            {
+              arguments.emplace_back(&visit<Value&>(without_tail_position(), node.arguments()[i]));
+            }
+          }
+
+          // a call to the function being generated, whose result is its caller's, becomes a jump back to its beginning
+          if(tail_position_ and tail_recursion_ and callee == builder_.GetInsertBlock()->getParent())
           {
-            arguments.emplace_back(&visit<Value&>(*this, arg_expression));
+            return emit_tail_recursion(arguments);
           }
 
           // create the call
-          return *builder_.CreateCall(callee, arguments, "calltmp");
+          CallInst& result = *builder_.CreateCall(callee, arguments, "calltmp");
+
+          // Kaleidoscope functions have no allocas for a callee to read, so any call in tail position may be a tail call
+          result.setTailCall(tail_position_);
+
+          return result;
         }
 
         llvm::Function& operator()(const function& node) const
@@ -296,10 +551,38 @@ class generator
           using namespace llvm;
 
           // check whether this function has already been declared
-          llvm::Function* result = module_.getFunction(node.prototype().name());
+          llvm::Function* result = module_.getFunction(node.prototype().name().str());
+
+          // a function of another module keeps its number of parameters, since its callers were compiled against it
+          std::optional<declared_function> previous_prototype = prototypes_[node.prototype().name()];
+
+          // calls are optimized for the effects of the callee's definition
+          function_effects effects = function_effects::unknown();
+          if(target_.options().infer_effects)
+          {
+            effects = effects_of(node, [&](symbol callee)
+            {
+              const std::optional<declared_function>& declared = prototypes_[callee];
+              return declared ? declared->effects : function_effects::unknown();
+            });
+          }
+
+          // calls generated from now on mustn't be specialized from the function's previous definition,
+          // and the specializations which called it may have inlined it
+          bool anonymous = is_anonymous(node.prototype().name().str());
+          if(!anonymous and previous_prototype)
+          {
+            definitions_[node.prototype().name()].reset();
+            specializations_.invalidate();
+          }
 
           if(!result)
           {
+            if(previous_prototype and previous_prototype->num_parameters != node.prototype().parameters().size())
+            {
+              throw std::runtime_error("Function redefined with a different number of parameters");
+            }
+
             // visit its prototype
             result = &operator()(node.prototype());
           }
@@ -309,44 +592,128 @@ class generator
             throw std::runtime_error("Function cannot be redefined");
           }
 
+          // check the signature before giving the declaration a body, which it would keep if this threw
+          const std::vector<symbol>& parameters = node.prototype().parameters();
+          if(result->arg_size() != parameters.size())
+          {
+            throw std::runtime_error("Function redefined with a different number of parameters");
+          }
+
           // create a new basic block as the insert point
           builder_.SetInsertPoint(BasicBlock::Create(context_, "entry", result));
 
+          // calls, including those in its body, may now be optimized for its effects
+          if(std::optional<declared_function>& declared = prototypes_[node.prototype().name()])
+          {
+            declared->effects = effects;
+          }
+
+          apply_effects(*result, effects);
+
           // insert the function arguments into the named values map
+          // using the names given by this definition, not the declaration
+          auto parameter = parameters.begin();
           for(auto& arg : result->args())
           {
-            named_values_[arg.getName()] = &arg;
+            arg.setName(parameter->str());
+            named_values_[*parameter] = &arg;
+            ++parameter;
           }
 
+          // first-tier functions count their calls, but anonymous expressions are only called once
+          GlobalVariable* call_counter = nullptr;
+          if(target_.options().tiered and node.prototype().name() != intern("__anon_expr"))
+          {
+            call_counter = &emit_call_counter(*result);
+          }
+
+          // calls to itself in tail position jump back to a block where the parameters take their new values
+          // the calls aren't counted, since they were never made
+          tail_recursion_state tail_recursion{};
+          if(target_.options().eliminate_tail_recursion and has_tail_recursion(node))
+          {
+            tail_recursion = begin_tail_recursion(*result, parameters);
+          }
+
+          visitor_type body_visitor = *this;
+          body_visitor.tail_position_ = true;
+          body_visitor.tail_recursion_ = tail_recursion.loop_block ? &tail_recursion : nullptr;
+
+          // unbinds the arguments and forgets shared values when we're done with the function
+          auto clear_named_values = [&]
+          {
+            for(symbol parameter : parameters)
+            {
+              named_values_[parameter] = nullptr;
+            }
+
+            shared_values_.clear();
+          };
+
           // visit the function body
           try
           {
-            builder_.CreateRet(&visit<Value&>(*this, node.body()));
+            builder_.CreateRet(&visit<Value&>(body_visitor, node.body()));
           }
           catch(...)
           {
-            // problem visiting the body, so erase the function
+            clear_named_values();
+
+            // problem visiting the body, so erase the function, and forget it unless it was declared before
             result->eraseFromParent();
+            prototypes_[node.prototype().name()] = previous_prototype;
+
+            if(call_counter)
+            {
+              call_counter->eraseFromParent();
+            }
 
             // rethrow the exception
             throw;
           }
 
+          clear_named_values();
+
           // validate the generated code
           verifyFunction(*result);
 
           // optimize
-          function_pass_manager_.run(*result);
+          optimizer_.optimize(*result);
 
-          // clear the named values
-          // XXX maybe this map should only exist when visiting a function
-          named_values_.clear();
+          // keep a copy of the definition, to specialize calls to it from, and to generate it again when a
+          // function it calls is redefined with more effects
+          if(!anonymous and (target_.options().specialize_constant_calls or target_.options().infer_effects))
+          {
+            definitions_[node.prototype().name()] = std::make_shared<const program>(serialized_program::from_bytes(serialize(node)).to_program());
+          }
 
-          return *result;
-        }
+          // a cache of its results only pays off when a function calls itself
+          bool calls_itself = false;
+          for_each_callee(node.body(), [&](symbol callee)
+          {
+            calls_itself = calls_itself or callee == node.prototype().name();
+          });
 
-        void operator()(const program& node) const
-        {
+          if(target_.options().memoize_recursion and effects.pure and calls_itself)
+          {
+            Function& wrapper = emit_memo_wrapper(*result);
+            verifyFunction(wrapper);
+            optimizer_.optimize(wrapper);
+            result = &wrapper;
+          }
+
+          // the callers of its previous definition were optimized for effects this one exceeds, so they're
+          // generated again after it, as if they'd been redefined, which may regenerate their callers in turn
+          if(previous_prototype and !previous_prototype->effects.allows(effects))
+          {
+            regenerate(previous_prototype->callers);
+          }
+
+          return *result;
+        }
+
+        void operator()(const program& node) const
+        {
           // visit each of the program's statements
           for(const auto& statement : node.statements())
           {
@@ -363,28 +730,789 @@ class generator
       private:
         friend generator;
 
-        visitor_type(llvm::LLVMContext& ctx,
+        // declares a function of doubles, returning a double, in the current module
+        llvm::Function& declare(symbol name, const declared_function& declared) const
+        {
+          using namespace llvm;
+
+          std::vector<Type*> parameter_types(declared.num_parameters, Type::getDoubleTy(context_));
+          FunctionType* function_type = FunctionType::get(Type::getDoubleTy(context_), parameter_types, false);
+
+          Function& result = *Function::Create(function_type, Function::ExternalLinkage, name.str(), &module_);
+
+          // the function may still be in the first tier, which counts its calls
+          if(!target_.options().tiered)
+          {
+            apply_effect_attributes(result, declared.effects);
+          }
+
+          return result;
+        }
+
+        // gives f, which is being defined, the attributes of its effects
+        // first-tier code counts its calls and calls the jit_compiler back, so first-tier definitions are only marked
+        // with their effects, which the jit_compiler turns into attributes once it has removed the counting
+        void apply_effects(llvm::Function& f, const function_effects& effects) const
+        {
+          if(!target_.options().tiered)
+          {
+            apply_effect_attributes(f, effects);
+            return;
+          }
+
+          f.removeFnAttr(pure_attribute_name);
+          f.removeFnAttr(terminates_attribute_name);
+
+          if(effects.pure)
+          {
+            f.addFnAttr(pure_attribute_name);
+          }
+
+          if(effects.terminates)
+          {
+            f.addFnAttr(terminates_attribute_name);
+          }
+        }
+
+        // gives f the attributes which let LLVM merge, delete, and hoist calls to it
+        // LLVM considers readnone nounwind calls free of side effects, so they're only given to pure functions,
+        // and speculatable calls may be made where they weren't written, so only functions which terminate get it
+        static void apply_effect_attributes(llvm::Function& f, const function_effects& effects)
+        {
+          using namespace llvm;
+
+          if(effects.pure)
+          {
+            f.setDoesNotAccessMemory();
+            f.setDoesNotThrow();
+          }
+          else
+          {
+            f.removeFnAttr(Attribute::ReadNone);
+            f.removeFnAttr(Attribute::NoUnwind);
+          }
+
+          if(effects.pure and effects.terminates)
+          {
+            f.addFnAttr(Attribute::Speculatable);
+          }
+          else
+          {
+            f.removeFnAttr(Attribute::Speculatable);
+          }
+        }
+
+        // generates the kept definitions of callers again in the current module, unless they've been defined in it
+        // a caller whose definition wasn't kept has since been declared again, and isn't this function's anymore
+        void regenerate(const std::vector<symbol>& callers) const
+        {
+          for(symbol caller : callers)
+          {
+            std::shared_ptr<const program> definition = definitions_[caller];
+            llvm::Function* existing = module_.getFunction(caller.str());
+
+            if(definition and (!existing or existing->isDeclaration()))
+            {
+              operator()(std::get<function>(definition->statements()[0]));
+            }
+          }
+        }
+
+        // anonymous expressions, and a whole program's entry points, are called once and thrown away
+        static bool is_anonymous(llvm::StringRef name)
+        {
+          return name == "__anon_expr" or name.startswith("__anon_expr.");
+        }
+
+        // a copy of this visitor for subexpressions whose value isn't the function's result
+        visitor_type without_tail_position() const
+        {
+          visitor_type result = *this;
+          result.tail_position_ = false;
+          return result;
+        }
+
+        // whether f's body calls f in tail position, where the call's result is f's result
+        static bool has_tail_recursion(const function& f)
+        {
+          // only the branches of an if in tail position are in tail position
+          std::vector<const expression*> tail_expressions{&f.body()};
+
+          while(!tail_expressions.empty())
+          {
+            const expression* e = tail_expressions.back();
+            tail_expressions.pop_back();
+
+            if(const if_expression* branch = ::get_if<if_expression>(e))
+            {
+              tail_expressions.push_back(&branch->then_expression());
+              tail_expressions.push_back(&branch->else_expression());
+            }
+            else if(const call* c = ::get_if<call>(e))
+            {
+              if(c->callee_name() == f.prototype().name() and c->arguments().size() == f.prototype().parameters().size())
+              {
+                return true;
+              }
+            }
+          }
+
+          return false;
+        }
+
+        // starts the loop which tail recursive calls jump to, and binds the parameters to its phis
+        tail_recursion_state begin_tail_recursion(llvm::Function& f, const std::vector<symbol>& parameters) const
+        {
+          using namespace llvm;
+
+          tail_recursion_state result;
+
+          BasicBlock* entry_block = builder_.GetInsertBlock();
+          result.loop_block = BasicBlock::Create(context_, "tailrecurse", &f);
+          builder_.CreateBr(result.loop_block);
+          builder_.SetInsertPoint(result.loop_block);
+
+          auto parameter = parameters.begin();
+          for(auto& arg : f.args())
+          {
+            PHINode* phi = builder_.CreatePHI(Type::getDoubleTy(context_), 2, parameter->str());
+            phi->addIncoming(&arg, entry_block);
+            result.parameters.push_back(phi);
+            named_values_[*parameter] = phi;
+            ++parameter;
+          }
+
+          return result;
+        }
+
+        llvm::Value& emit_tail_recursion(const std::vector<llvm::Value*>& arguments) const
+        {
+          using namespace llvm;
+
+          BasicBlock* current_block = builder_.GetInsertBlock();
+          for(std::size_t i = 0; i < arguments.size(); ++i)
+          {
+            tail_recursion_->parameters[i]->addIncoming(arguments[i], current_block);
+          }
+
+          builder_.CreateBr(tail_recursion_->loop_block);
+
+          // nothing follows the jump, so whatever is generated after it is unreachable, and will be deleted
+          builder_.SetInsertPoint(BasicBlock::Create(context_, "aftertailcall", current_block->getParent()));
+          return *UndefValue::get(Type::getDoubleTy(context_));
+        }
+
+        // emits the loop as written: the end expression is evaluated after each iteration, and
+        // the loop variable is a double which the step is added to
+        llvm::Value& emit_loop(const for_expression& node, llvm::Value& begin_value) const
+        {
+          using namespace llvm;
+
+          // create a basic block for the loop body,
+          // after the current function's current block
+          BasicBlock* pre_loop_block = builder_.GetInsertBlock();
+          Function* current_function = pre_loop_block->getParent();
+          BasicBlock* loop_body_block = BasicBlock::Create(context_, "loop", current_function);
+
+          // insert an explicit branch from the pre_loop_blocko the loop_body_block
+          builder_.CreateBr(loop_body_block);
+
+          // begin inserting IR into the loop body
+          builder_.SetInsertPoint(loop_body_block);
+
+          // create the loop variable, which takes its value from a phi node
+          PHINode& loop_variable = *builder_.CreatePHI(Type::getDoubleTy(context_), 2, node.loop_variable_name().str());
+          loop_variable.addIncoming(&begin_value, pre_loop_block);
+
+          // shadow any variable in the outer scope with the same name as the loop variable
+          Value* shadowed_variable = named_values_[node.loop_variable_name()];
+
+          // map the loop variable name to its value
+          named_values_[node.loop_variable_name()] = &loop_variable;
+
+          // generate code for the loop body
+          visit<Value&>(*this, node.body());
+
+          // generate code for the loop step
+          Value& step_value = node.step()
+            ? visit<Value&>(*this, *node.step())
+            : *ConstantFP::get(context_, APFloat(1.0))
+          ;
+
+          // add the step to the loop variable to create its next value
+          Value& next_value_of_loop_variable = *builder_.CreateFAdd(&loop_variable, &step_value, "nextvar");
+
+          // generate the end value
+          Value& end_value = visit<Value&>(*this, node.end());
+
+          // convert the end value to a boolean
+          Value& end_condition = *builder_.CreateFCmpONE(&end_value, ConstantFP::get(context_, APFloat(0.0)), "loopcond");
+
+          // note the block which ends the loop
+          BasicBlock* loop_end_block = builder_.GetInsertBlock();
+
+          // hook up the loop variable node to the next iteration's value
+          loop_variable.addIncoming(&next_value_of_loop_variable, loop_end_block);
+
+          // create the block following the loop body
+          BasicBlock* post_loop_block = BasicBlock::Create(context_, "postloop", current_function);
+
+          // create the branch at the end of the loop
+          builder_.CreateCondBr(&end_condition, loop_body_block, post_loop_block);
+
+          // point the builder at the block following the loop
+          builder_.SetInsertPoint(post_loop_block);
+
+          // restore the shadowed variable
+          named_values_[node.loop_variable_name()] = shadowed_variable;
+
+          // loop expressions always return 0.0
+          return *ConstantFP::get(context_, APFloat(0.0));
+        }
+
+        // if node is written for i = a, i < n[, s] in body, where n doesn't depend on the loop
+        // and s is a positive integer, returns n, and s through step
+        static const expression* counted_loop_bound(const for_expression& node, std::int64_t& step)
+        {
+          step = 1;
+          if(node.step())
+          {
+            const number* constant_step = ::get_if<number>(&*node.step());
+            if(!constant_step or constant_step->value() < 1 or constant_step->value() > 0x1p32 or
+               constant_step->value() != std::trunc(constant_step->value()))
+            {
+              return nullptr;
+            }
+
+            step = static_cast<std::int64_t>(constant_step->value());
+          }
+
+          const binary_operation* condition = ::get_if<binary_operation>(&node.end());
+          if(!condition or condition->op() != '<')
+          {
+            return nullptr;
+          }
+
+          const variable* loop_variable = ::get_if<variable>(&condition->lhs());
+          if(!loop_variable or loop_variable->name() != node.loop_variable_name())
+          {
+            return nullptr;
+          }
+
+          return is_loop_invariant(condition->rhs(), node.loop_variable_name()) ? &condition->rhs() : nullptr;
+        }
+
+        // an expression is loop invariant if it's computed from numbers and variables other than
+        // the loop variable, so that evaluating it once gives the value each iteration would
+        static bool is_loop_invariant(const expression& e, symbol loop_variable_name)
+        {
+          // shared subtrees are only checked once
+          std::vector<const expression*> work{&e};
+          std::unordered_set<const binary_operation*> checked;
+
+          while(!work.empty())
+          {
+            const expression* item = work.back();
+            work.pop_back();
+
+            if(const binary_operation* operation = ::get_if<binary_operation>(item))
+            {
+              if(checked.insert(operation).second)
+              {
+                work.push_back(&operation->lhs());
+                work.push_back(&operation->rhs());
+              }
+            }
+            else if(const variable* v = ::get_if<variable>(item))
+            {
+              if(v->name() == loop_variable_name)
+              {
+                return false;
+              }
+            }
+            else if(!::get_if<number>(item))
+            {
+              return false;
+            }
+          }
+
+          return true;
+        }
+
+        // emits for i = a, i < n, step in body as a loop which runs 1 + max(0, ceil((ceil(n) - a) / step)) times
+        //
+        // the body sees the same values of i as emit_loop's repeated additions would give it, provided
+        // that a is an integer other than -0.0, and that a and n are small enough for every integer up to them to be a double
+        // otherwise, the loop is run as written
+        llvm::Value& emit_counted_loop(const for_expression& node, const expression& bound, std::int64_t step) const
+        {
+          using namespace llvm;
+
+          Type* double_type = Type::getDoubleTy(context_);
+          Type* count_type = Type::getInt64Ty(context_);
+
+          Value& begin_value = visit<Value&>(*this, node.begin());
+          Value& bound_value = visit<Value&>(*this, bound);
+
+          Function* current_function = builder_.GetInsertBlock()->getParent();
+          Function* fabs = Intrinsic::getDeclaration(&module_, Intrinsic::fabs, {double_type});
+          Function* trunc = Intrinsic::getDeclaration(&module_, Intrinsic::trunc, {double_type});
+          Function* ceil = Intrinsic::getDeclaration(&module_, Intrinsic::ceil, {double_type});
+
+          // NaN fails each comparison, so a NaN bound, which would never end the loop, runs it as written
+          Value* begin_is_integer = builder_.CreateFCmpOEQ(builder_.CreateCall(trunc, {&begin_value}), &begin_value, "beginisinteger");
+          Value* begin_is_small = builder_.CreateFCmpOLE(builder_.CreateCall(fabs, {&begin_value}), ConstantFP::get(double_type, 0x1p52), "beginissmall");
+          Value* bound_is_small = builder_.CreateFCmpOLE(builder_.CreateCall(fabs, {&bound_value}), ConstantFP::get(double_type, 0x1p53), "boundissmall");
+
+          // -0.0 is an integer, but converting it to an integer and back would show the body +0.0 first
+          Value* begin_is_not_negative_zero = builder_.CreateICmpNE(builder_.CreateBitCast(&begin_value, count_type), ConstantInt::get(count_type, 0x8000000000000000), "beginisnotnegativezero");
+
+          Value* is_counted = builder_.CreateAnd(builder_.CreateAnd(builder_.CreateAnd(begin_is_integer, begin_is_not_negative_zero), begin_is_small), bound_is_small, "iscounted");
+
+          BasicBlock* counted_preheader_block = BasicBlock::Create(context_, "countedpreheader", current_function);
+          BasicBlock* uncounted_block = BasicBlock::Create(context_, "uncounted", current_function);
+          builder_.CreateCondBr(is_counted, counted_preheader_block, uncounted_block);
+
+          // the fallback is rarely taken, so loops nested in it aren't versioned again
+          builder_.SetInsertPoint(uncounted_block);
+          visitor_type generic = *this;
+          generic.generic_loops_ = true;
+          generic.emit_loop(node, begin_value);
+          BasicBlock* uncounted_end_block = builder_.GetInsertBlock();
+
+          // i < n exactly when i < ceil(n), for integer i, so the trip count can be computed with integers
+          builder_.SetInsertPoint(counted_preheader_block);
+          Value* first = builder_.CreateFPToSI(&begin_value, count_type, "first");
+          Value* last = builder_.CreateFPToSI(builder_.CreateCall(ceil, {&bound_value}), count_type, "last");
+          Value* distance = builder_.CreateNSWSub(last, first, "distance");
+          Value* steps = builder_.CreateUDiv(builder_.CreateNSWAdd(distance, ConstantInt::get(count_type, step - 1)), ConstantInt::get(count_type, step), "steps");
+          steps = builder_.CreateSelect(builder_.CreateICmpSGT(distance, ConstantInt::get(count_type, 0)), steps, ConstantInt::get(count_type, 0));
+
+          // the body runs once more than the number of steps, since the condition is checked after it
+          Value* trip_count = builder_.CreateNUWAdd(steps, ConstantInt::get(count_type, 1), "tripcount");
+
+          BasicBlock* loop_body_block = BasicBlock::Create(context_, "countedloop", current_function);
+          builder_.CreateBr(loop_body_block);
+          builder_.SetInsertPoint(loop_body_block);
+
+          PHINode& iteration = *builder_.CreatePHI(count_type, 2, "iteration");
+          iteration.addIncoming(ConstantInt::get(count_type, 0), counted_preheader_block);
+
+          Value* loop_variable = builder_.CreateSIToFP(
+            builder_.CreateNSWAdd(first, builder_.CreateNSWMul(&iteration, ConstantInt::get(count_type, step))),
+            double_type,
+            node.loop_variable_name().str()
+          );
+
+          // shadow any variable in the outer scope with the same name as the loop variable
+          Value* shadowed_variable = named_values_[node.loop_variable_name()];
+          named_values_[node.loop_variable_name()] = loop_variable;
+
+          visit<Value&>(*this, node.body());
+
+          Value* next_iteration = builder_.CreateNUWAdd(&iteration, ConstantInt::get(count_type, 1), "nextiteration");
+          iteration.addIncoming(next_iteration, builder_.GetInsertBlock());
+
+          BasicBlock* post_loop_block = BasicBlock::Create(context_, "postloop", current_function);
+          builder_.CreateCondBr(builder_.CreateICmpULT(next_iteration, trip_count, "loopcond"), loop_body_block, post_loop_block);
+
+          // the fallback joins the counted loop after it
+          builder_.SetInsertPoint(uncounted_end_block);
+          builder_.CreateBr(post_loop_block);
+
+          builder_.SetInsertPoint(post_loop_block);
+          named_values_[node.loop_variable_name()] = shadowed_variable;
+
+          // loop expressions always return 0.0
+          return *ConstantFP::get(context_, APFloat(0.0));
+        }
+
+        // the arguments of node which are numbers, or variables bound to constants in a specialization
+        constant_arguments constant_arguments_of(const call& node) const
+        {
+          using namespace llvm;
+
+          constant_arguments result;
+          for(const expression& argument : node.arguments())
+          {
+            std::optional<double> value;
+            if(const number* n = ::get_if<number>(&argument))
+            {
+              value = n->value();
+            }
+            else if(const variable* v = ::get_if<variable>(&argument))
+            {
+              if(const ConstantFP* c = dyn_cast_or_null<ConstantFP>(named_values_[v->name()]))
+              {
+                value = c->getValueAPF().convertToDouble();
+              }
+            }
+
+            result.emplace_back();
+            if(value)
+            {
+              std::uint64_t bits;
+              std::memcpy(&bits, &*value, sizeof(bits));
+              result.back() = bits;
+            }
+          }
+
+          return result;
+        }
+
+        // returns the function to call instead of callee, specialized for the constant arguments, generating it
+        // on the first call with them, or nullptr when there are none, or callee's definition wasn't kept
+        //
+        // constants only come from the program's numbers, so a program has finitely many specializations, though
+        // a function which passes its constant parameters to itself unchanged calls its specialization
+        llvm::Function* specialize(symbol callee_name, llvm::Function& callee, const constant_arguments& constants) const
+        {
+          using namespace llvm;
+
+          // a function defined in this module may be internalized along with its callers, so isn't specialized
+          // the definition is copied out of the cache, since generating the specialization may grow it
+          std::shared_ptr<const program> definition = definitions_[callee_name];
+          if(!definition or !callee.isDeclaration())
+          {
+            return nullptr;
+          }
+
+          std::size_t num_parameters = std::count(constants.begin(), constants.end(), std::nullopt);
+          if(num_parameters == constants.size())
+          {
+            return nullptr;
+          }
+
+          auto key = std::make_pair(callee_name, constants);
+          auto found = specializations_.specializations.find(key);
+          if(found != specializations_.specializations.end())
+          {
+            // it's in the module being generated, or was generated for an earlier module
+            Function* existing = module_.getFunction(found->second.str());
+
+            // a specialization's calls to itself aren't reuses
+            if(existing != builder_.GetInsertBlock()->getParent())
+            {
+              ++specializations_.statistics.num_hits;
+            }
+
+            return existing ? existing : &declare(found->second, *prototypes_[found->second]);
+          }
+
+          // the specialization is entered first, so that calls in its body with the same constants call it
+          symbol name = intern(callee_name.str() + specialization_infix + std::to_string(specializations_.num_named++));
+          prototypes_[name] = declared_function{num_parameters, prototypes_[callee_name]->effects, {}};
+          specializations_.specializations.emplace(key, name);
+
+          Function& result = generate_specialization(name, std::get<function>(definition->statements()[0]), constants);
+          ++specializations_.statistics.num_misses;
+
+          return module_.getFunction(name.str()) ? &result : &declare(name, *prototypes_[name]);
+        }
+
+        // generates f, named name, in the specializations' module, with the parameters whose arguments are constant
+        // bound to them, and the others its parameters
+        llvm::Function& generate_specialization(symbol name, const function& f, const constant_arguments& constants) const
+        {
+          using namespace llvm;
+
+          Module& module = *specializations_.module;
+          Function& result = *Function::Create(
+            FunctionType::get(Type::getDoubleTy(context_), std::vector<Type*>(prototypes_[name]->num_parameters, Type::getDoubleTy(context_)), false),
+            Function::ExternalLinkage,
+            name.str(),
+            &module
+          );
+          apply_effects(result, prototypes_[name]->effects);
+
+          // the specialization is generated in the middle of its caller, with names and shared values of its own
+          symbol_map<Value*> named_values;
+          shared_value_map shared_values;
+          visitor_type body_visitor(target_, context_, builder_, module, optimizer_, named_values, shared_values, prototypes_, host_effects_, definitions_, specializations_);
+          body_visitor.tail_position_ = true;
+
+          IRBuilderBase::InsertPointGuard restore_insert_point(builder_);
+          builder_.SetInsertPoint(BasicBlock::Create(context_, "entry", &result));
+
+          auto constant = [&](std::size_t i) -> Value*
+          {
+            double value;
+            std::memcpy(&value, &*constants[i], sizeof(value));
+            return ConstantFP::get(context_, APFloat(value));
+          };
+
+          const std::vector<symbol>& parameters = f.prototype().parameters();
+          std::vector<symbol> specialized_parameters;
+          auto arg = result.arg_begin();
+          for(std::size_t i = 0; i < parameters.size(); ++i)
+          {
+            if(constants[i])
+            {
+              named_values[parameters[i]] = constant(i);
+            }
+            else
+            {
+              arg->setName(parameters[i].str());
+              named_values[parameters[i]] = &*arg;
+              specialized_parameters.push_back(parameters[i]);
+              ++arg;
+            }
+          }
+
+          // tiered specializations count their calls like any other function
+          GlobalVariable* call_counter = nullptr;
+          if(target_.options().tiered)
+          {
+            call_counter = &body_visitor.emit_call_counter(result);
+          }
+
+          // calls to itself which pass its constants along call the specialization, and may become jumps
+          tail_recursion_state tail_recursion{};
+          if(target_.options().eliminate_tail_recursion and has_tail_recursion(f))
+          {
+            tail_recursion = body_visitor.begin_tail_recursion(result, specialized_parameters);
+            body_visitor.tail_recursion_ = &tail_recursion;
+          }
+
+          try
+          {
+            builder_.CreateRet(&visit<Value&>(body_visitor, f.body()));
+          }
+          catch(...)
+          {
+            // the definition calls functions which are no longer available, so instead of its body, the
+            // specialization calls the function itself. it can't be erased, since its body may have called it
+            result.deleteBody();
+
+            if(call_counter)
+            {
+              call_counter->eraseFromParent();
+            }
+
+            Function* general = module.getFunction(f.prototype().name().str());
+            if(!general)
+            {
+              general = &body_visitor.declare(f.prototype().name(), declared_function{constants.size(), prototypes_[name]->effects, {}});
+            }
+
+            builder_.SetInsertPoint(BasicBlock::Create(context_, "entry", &result));
+
+            std::vector<Value*> arguments;
+            arg = result.arg_begin();
+            for(std::size_t i = 0; i < constants.size(); ++i)
+            {
+              arguments.push_back(constants[i] ? constant(i) : &*arg++);
+            }
+
+            builder_.CreateRet(builder_.CreateCall(general, arguments, "calltmp"));
+          }
+
+          verifyFunction(result);
+          optimizer_.optimize(result);
+
+          return result;
+        }
+
+        // renames f, and takes its place with a function which returns f's cached results,
+        // calling f only for arguments which aren't in the cache. f's calls to itself go through the cache
+        // f is pure, so its declarations in other modules keep its effects, though the wrapper writes to the cache
+        llvm::Function& emit_memo_wrapper(llvm::Function& f) const
+        {
+          using namespace llvm;
+
+          std::string name = f.getName().str();
+          f.setName(name + ".uncached");
+          f.setLinkage(GlobalValue::InternalLinkage);
+
+          // f now writes to the cache through its calls to itself
+          apply_effects(f, function_effects::unknown());
+
+          Function& result = *Function::Create(f.getFunctionType(), Function::ExternalLinkage, name, &module_);
+          f.replaceAllUsesWith(&result);
+
+          Type* double_type = Type::getDoubleTy(context_);
+          Type* count_type = Type::getInt64Ty(context_);
+          Type* pointer_type = Type::getInt8PtrTy(context_);
+          Type* double_pointer_type = double_type->getPointerTo();
+
+          BasicBlock* entry_block = BasicBlock::Create(context_, "entry", &result);
+          builder_.SetInsertPoint(entry_block);
+
+          // the table reads the arguments from memory, and writes a cached result to memory
+          std::vector<Value*> arguments;
+          Value* argument_array = builder_.CreateAlloca(double_type, ConstantInt::get(count_type, f.arg_size()), "arguments");
+          auto parameter = f.arg_begin();
+          for(auto& arg : result.args())
+          {
+            arg.setName(parameter->getName());
+            builder_.CreateStore(&arg, builder_.CreateConstGEP1_64(argument_array, arguments.size()));
+            arguments.push_back(&arg);
+            ++parameter;
+          }
+
+          Value* cached_result = builder_.CreateAlloca(double_type, nullptr, "cached");
+
+          // the table's address is asked for once, on the first call
+          GlobalVariable& table_address = *new GlobalVariable(module_, pointer_type, false, GlobalValue::InternalLinkage, ConstantPointerNull::get(cast<PointerType>(pointer_type)), name + memo_table_suffix);
+          Value* existing_table = builder_.CreateLoad(&table_address, "table");
+
+          BasicBlock* find_table_block = BasicBlock::Create(context_, "findtable", &result);
+          BasicBlock* lookup_block = BasicBlock::Create(context_, "lookup", &result);
+          builder_.CreateCondBr(builder_.CreateIsNull(existing_table), find_table_block, lookup_block);
+
+          builder_.SetInsertPoint(find_table_block);
+          Constant* table_for = module_.getOrInsertFunction(memo_table_function_name, FunctionType::get(pointer_type, {pointer_type, pointer_type, count_type}, false));
+          Constant* jit = module_.getOrInsertGlobal(tier_up_context_name, Type::getInt8Ty(context_));
+          Value* new_table = builder_.CreateCall(table_for, {jit, builder_.CreateGlobalStringPtr(name), ConstantInt::get(count_type, f.arg_size())});
+          builder_.CreateStore(new_table, &table_address);
+          builder_.CreateBr(lookup_block);
+
+          builder_.SetInsertPoint(lookup_block);
+          PHINode* table = builder_.CreatePHI(pointer_type, 2, "table");
+          table->addIncoming(existing_table, entry_block);
+          table->addIncoming(new_table, find_table_block);
+
+          Constant* find = module_.getOrInsertFunction(memo_find_function_name, FunctionType::get(Type::getInt32Ty(context_), {pointer_type, double_pointer_type, double_pointer_type}, false));
+          Value* found = builder_.CreateCall(find, {table, argument_array, cached_result});
+
+          BasicBlock* hit_block = BasicBlock::Create(context_, "hit", &result);
+          BasicBlock* miss_block = BasicBlock::Create(context_, "miss", &result);
+          builder_.CreateCondBr(builder_.CreateICmpNE(found, ConstantInt::get(Type::getInt32Ty(context_), 0)), hit_block, miss_block);
+
+          builder_.SetInsertPoint(hit_block);
+          builder_.CreateRet(builder_.CreateLoad(cached_result));
+
+          builder_.SetInsertPoint(miss_block);
+          Value* computed_result = builder_.CreateCall(&f, arguments, "uncached");
+          Constant* insert = module_.getOrInsertFunction(memo_insert_function_name, FunctionType::get(Type::getVoidTy(context_), {pointer_type, double_pointer_type, double_type}, false));
+          builder_.CreateCall(insert, {table, argument_array, computed_result});
+          builder_.CreateRet(computed_result);
+
+          return result;
+        }
+
+        // counts f's calls, and asks the jit_compiler to recompile f when the count reaches the threshold
+        // returns the counter, and leaves the builder where f's body begins
+        llvm::GlobalVariable& emit_call_counter(llvm::Function& f) const
+        {
+          using namespace llvm;
+
+          Type* count_type = Type::getInt64Ty(context_);
+          GlobalVariable& result = *new GlobalVariable(module_, count_type, false, GlobalValue::InternalLinkage, ConstantInt::get(count_type, 0), f.getName() + call_counter_suffix);
+
+          // counting needn't be atomic: first-tier code only runs on the interpreter's thread,
+          // and the count only needs to cross the threshold once
+          Value* count = builder_.CreateAdd(builder_.CreateLoad(&result), ConstantInt::get(count_type, 1), "calls");
+          builder_.CreateStore(count, &result);
+
+          BasicBlock* tier_up_block = BasicBlock::Create(context_, "tierup", &f);
+          BasicBlock* body_block = BasicBlock::Create(context_, "body", &f);
+          builder_.CreateCondBr(builder_.CreateICmpEQ(count, ConstantInt::get(count_type, target_.options().tier_up_threshold)), tier_up_block, body_block);
+
+          // call the jit_compiler back with its own address and f's name
+          builder_.SetInsertPoint(tier_up_block);
+          Type* pointer_type = Type::getInt8PtrTy(context_);
+          Constant* tier_up = module_.getOrInsertFunction(tier_up_function_name, FunctionType::get(Type::getVoidTy(context_), {pointer_type, pointer_type}, false));
+          Constant* jit = module_.getOrInsertGlobal(tier_up_context_name, Type::getInt8Ty(context_));
+          builder_.CreateCall(tier_up, {jit, builder_.CreateGlobalStringPtr(f.getName())});
+          builder_.CreateBr(body_block);
+
+          builder_.SetInsertPoint(body_block);
+          return result;
+        }
+
+        llvm::Value& emit_binary_operation(char op, llvm::Value& lhs, llvm::Value& rhs) const
+        {
+          using namespace llvm;
+
+          // emit the appropriate instruction
+          Value* result = nullptr;
+          switch(op)
+          {
+            case '+':
+            {
+              result = builder_.CreateFAdd(&lhs, &rhs, "addtmp");
+              break;
+            }
+
+            case '-':
+            {
+              result = builder_.CreateFSub(&lhs, &rhs, "subtmp");
+              break;
+            }
+
+            case '*':
+            {
+              result = builder_.CreateFMul(&lhs, &rhs, "multmp");
+              break;
+            }
+
+            case '<':
+            {
+              // create the result of the comparison
+              Value* compare_result = builder_.CreateFCmpULT(&lhs, &rhs, "cmptmp");
+
+              // convert the unsigned integer result to floating point
+              result = builder_.CreateUIToFP(compare_result, Type::getDoubleTy(context_), "booltmp");
+              break;
+            }
+
+            default:
+            {
+              throw std::runtime_error("Invalid binary operator");
+            }
+          }
+
+          return *result;
+        }
+
+        visitor_type(target_context& target,
+                     llvm::LLVMContext& ctx,
                      llvm::IRBuilder<>& builder,
                      llvm::Module& module,
-                     llvm::legacy::FunctionPassManager& function_pass_manager,
-                     std::map<std::string, llvm::Value*>& named_values)
-          : context_(ctx),
+                     optimizer& opt,
+                     symbol_map<llvm::Value*>& named_values,
+                     shared_value_map& shared_values,
+                     prototype_map& prototypes,
+                     symbol_map<function_effects>& host_effects,
+                     symbol_map<std::shared_ptr<const program>>& definitions,
+                     specialization_cache& specializations)
+          : target_(target),
+            context_(ctx),
             builder_(builder),
             module_(module),
-            function_pass_manager_(function_pass_manager),
-            named_values_(named_values)
+            optimizer_(opt),
+            named_values_(named_values),
+            shared_values_(shared_values),
+            prototypes_(prototypes),
+            host_effects_(host_effects),
+            definitions_(definitions),
+            specializations_(specializations)
         {}
 
+        target_context& target_;
         llvm::LLVMContext& context_;
         llvm::IRBuilder<>& builder_;
         llvm::Module& module_;
-        llvm::legacy::FunctionPassManager& function_pass_manager_;
-        std::map<std::string, llvm::Value*>& named_values_;
+        optimizer& optimizer_;
+        symbol_map<llvm::Value*>& named_values_;
+        shared_value_map& shared_values_;
+        prototype_map& prototypes_;
+        symbol_map<function_effects>& host_effects_;
+        symbol_map<std::shared_ptr<const program>>& definitions_;
+        specialization_cache& specializations_;
+
+        // whether loops are emitted as written, rather than as counted loops
+        bool generic_loops_ = false;
+
+        // whether the expression being visited is the function's result, and where its calls to itself in that position go
+        bool tail_position_ = false;
+        const tail_recursion_state* tail_recursion_ = nullptr;
     };
 
     visitor_type visitor()
     {
-      return visitor_type{context_, builder_, *module_, *function_pass_manager_, named_values_};
+      return visitor_type{*target_, context_, builder_, *module_, *optimizer_, named_values_, shared_values_, prototypes_, host_effects_, definitions_, specializations_};
     }
 
     const llvm::Module& module() const
@@ -393,40 +1521,34 @@ class generator
     }
 
   private:
-    static std::unique_ptr<llvm::Module> make_module(llvm::LLVMContext& ctx)
-    {
-      std::unique_ptr<llvm::Module> result = std::make_unique<llvm::Module>("my jit", ctx);
-      result->setDataLayout(llvm::EngineBuilder().selectTarget()->createDataLayout());
-
-      return result;
-    }
-
-    static std::unique_ptr<llvm::legacy::FunctionPassManager> make_function_pass_manager(llvm::Module& module)
+    std::unique_ptr<llvm::Module> make_module()
     {
-      auto result = std::make_unique<llvm::legacy::FunctionPassManager>(&module);
-
-      // simple "peephole" optimizations and bit-twiddling optimizations
-      result->add(llvm::createInstructionCombiningPass());
-
-      // reassociate expressions
-      result->add(llvm::createReassociatePass());
-
-      // eliminate common subexpressions
-      result->add(llvm::createGVNPass());
-
-      // simplify control flow graph
-      result->add(llvm::createCFGSimplificationPass());
-
-      // now initialize
-      result->doInitialization();
+      std::unique_ptr<llvm::Module> result = std::make_unique<llvm::Module>("my jit", context_);
+      result->setDataLayout(target_->data_layout());
+      result->setTargetTriple(target_->target_triple());
 
       return result;
     }
 
+    // shared with the jit_compiler, rather than rebuilt for each module
+    target_context* target_;
     llvm::LLVMContext context_;
     llvm::IRBuilder<> builder_;
     std::unique_ptr<llvm::Module> module_;
-    std::unique_ptr<llvm::legacy::FunctionPassManager> function_pass_manager_;
-    std::map<std::string, llvm::Value*> named_values_;
+    // runs the target's pipelines on each function and each released module
+    std::unique_ptr<optimizer> optimizer_;
+    // indexed by symbol, so lookup and shadowing are O(1)
+    symbol_map<llvm::Value*> named_values_;
+    // the values of the pure binary operations in the function being generated
+    shared_value_map shared_values_;
+    // every function declared or defined so far, so that each module only declares the functions it calls
+    prototype_map prototypes_;
+    // what the host's functions may do, which is unknown unless they've been annotated
+    symbol_map<function_effects> host_effects_;
+    // copies of the definitions which may be specialized or generated again, since the parser's nodes may be
+    // freed after each statement
+    symbol_map<std::shared_ptr<const program>> definitions_;
+    // the specializations of the kept definitions for the constant arguments they've been called with
+    specialization_cache specializations_;
 };
 
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include "syntax.hpp"
+#include "overloaded.hpp"
+
+// a node_factory makes the nodes of expressions, sharing structurally equal subtrees
+//
+// the factory interns each node as it is made. its children have already been
+// interned, so two subtrees are structurally equal exactly when their roots
+// have the same operator and the same children, which is a constant-time
+// comparison, and a node's hash is computed once from its operator and its
+// children's identities. the nodes live in the current arena, so the factory
+// must be cleared whenever the arena is released
+class node_factory
+{
+  public:
+    template<class Node>
+    expression make(Node&& node)
+    {
+      static_assert(!std::is_reference_v<Node>, "node_factory::make: node must be an rvalue");
+
+      auto& table = std::get<table_type<Node>>(tables_);
+
+      std::size_t hash = shallow_hash(node);
+
+      auto [first, last] = table.equal_range(hash);
+      for(; first != last; ++first)
+      {
+        if(shallow_equal(*first->second, node))
+        {
+          ++num_shared_;
+          return detail::wrapped<Node>::share(*first->second);
+        }
+      }
+
+      detail::wrapped<Node> result(std::move(node));
+      table.emplace(hash, &result.value());
+      ++num_unique_;
+
+      return result;
+    }
+
+    // forgets the nodes made so far
+    void clear()
+    {
+      std::apply([](auto&... tables)
+      {
+        (tables.clear(), ...);
+      },
+      tables_);
+    }
+
+    // the number of nodes made which were shared with an existing equal node
+    std::size_t num_shared() const
+    {
+      return num_shared_;
+    }
+
+    // the number of distinct nodes made
+    std::size_t num_unique() const
+    {
+      return num_unique_;
+    }
+
+    // hashes an expression made by a node_factory
+    static std::size_t hash(const expression& e)
+    {
+      return combine(e.index(), identity(e));
+    }
+
+    // compares expressions made by the same node_factory
+    static bool equal(const expression& a, const expression& b)
+    {
+      return a.index() == b.index() and identity(a) == identity(b);
+    }
+
+  private:
+    template<class Node>
+    using table_type = std::unordered_multimap<std::size_t, const Node*>;
+
+    static std::size_t combine(std::size_t seed, std::size_t value)
+    {
+      return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+    }
+
+    // numbers and variables are stored by value, and interned nodes are identified by address
+    static std::uint64_t identity(const expression& e)
+    {
+      return ::visit(overloaded(
+        [](const number& node)
+        {
+          std::uint64_t result;
+          double value = node.value();
+          std::memcpy(&result, &value, sizeof(result));
+          return result;
+        },
+        [](const variable& node)
+        {
+          return static_cast<std::uint64_t>(node.name().id());
+        },
+        [](const auto& node)
+        {
+          return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(&node));
+        }),
+        e
+      );
+    }
+
+    static std::size_t shallow_hash(const binary_operation& node)
+    {
+      return combine(combine(node.op(), hash(node.lhs())), hash(node.rhs()));
+    }
+
+    static bool shallow_equal(const binary_operation& a, const binary_operation& b)
+    {
+      return a.op() == b.op() and equal(a.lhs(), b.lhs()) and equal(a.rhs(), b.rhs());
+    }
+
+    static std::size_t shallow_hash(const call& node)
+    {
+      std::size_t result = node.callee_name().id();
+      for(const expression& argument : node.arguments())
+      {
+        result = combine(result, hash(argument));
+      }
+
+      return result;
+    }
+
+    static bool shallow_equal(const call& a, const call& b)
+    {
+      return a.callee_name() == b.callee_name() and
+             std::equal(a.arguments().begin(), a.arguments().end(),
+                        b.arguments().begin(), b.arguments().end(),
+                        equal);
+    }
+
+    static std::size_t shallow_hash(const if_expression& node)
+    {
+      return combine(combine(hash(node.condition()), hash(node.then_expression())), hash(node.else_expression()));
+    }
+
+    static bool shallow_equal(const if_expression& a, const if_expression& b)
+    {
+      return equal(a.condition(), b.condition()) and
+             equal(a.then_expression(), b.then_expression()) and
+             equal(a.else_expression(), b.else_expression());
+    }
+
+    static std::size_t shallow_hash(const for_expression& node)
+    {
+      std::size_t result = combine(node.loop_variable_name().id(), hash(node.begin()));
+      result = combine(result, hash(node.end()));
+      result = combine(result, node.step() ? hash(*node.step()) : 0);
+      return combine(result, hash(node.body()));
+    }
+
+    static bool shallow_equal(const for_expression& a, const for_expression& b)
+    {
+      return a.loop_variable_name() == b.loop_variable_name() and
+             equal(a.begin(), b.begin()) and
+             equal(a.end(), b.end()) and
+             a.step().has_value() == b.step().has_value() and
+             (!a.step() or equal(*a.step(), *b.step())) and
+             equal(a.body(), b.body());
+    }
+
+    std::tuple<
+      table_type<binary_operation>,
+      table_type<call>,
+      table_type<if_expression>,
+      table_type<for_expression>
+    > tables_;
+
+    std::size_t num_shared_ = 0;
+    std::size_t num_unique_ = 0;
+};
+
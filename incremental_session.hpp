@@ -0,0 +1,336 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "parser.hpp"
+#include "generator.hpp"
+#include "jit_compiler.hpp"
+#include "specialization_modules.hpp"
+#include "statement_boundaries.hpp"
+#include "walk.hpp"
+#include "overloaded.hpp"
+
+// an incremental_session interprets successive versions of the same file
+//
+// the file is cut into segments at statement boundaries, and each segment is
+// keyed by its text with comments removed and whitespace collapsed. when a new
+// version is loaded, segments whose keys are unchanged keep their ASTs and
+// compiled modules. only new segments are parsed, and only new segments and
+// those which call, directly or transitively, a function whose definition
+// changed are regenerated, recompiled, and (for top-level expressions) evaluated again
+class incremental_session
+{
+  public:
+    struct load_statistics
+    {
+      std::size_t num_segments = 0;
+      std::size_t num_reused = 0;
+      std::size_t num_parsed = 0;
+      std::size_t num_recompiled = 0;
+      std::size_t num_evaluated = 0;
+    };
+
+    // interprets text, the latest version of the file
+    load_statistics load(std::string_view text)
+    {
+      load_statistics result;
+
+      // index the previous version's segments by key
+      // keys view the segments' own strings, which don't move when the segments do
+      std::unordered_multimap<std::string_view, std::unique_ptr<segment>> previous;
+      for(auto& s : segments_)
+      {
+        std::string_view key = s->key;
+        previous.emplace(key, std::move(s));
+      }
+      segments_.clear();
+
+      // the names whose definitions or declarations have changed
+      std::unordered_set<symbol> changed;
+
+      // reuse unchanged segments and parse the rest
+      std::vector<bool> stale;
+      for(std::string_view text_of_segment : split_at_every_statement_boundary(text))
+      {
+        std::string key = make_key(text_of_segment);
+        if(key.empty())
+        {
+          continue;
+        }
+
+        auto found = previous.find(key);
+        if(found != previous.end())
+        {
+          segments_.push_back(std::move(found->second));
+          previous.erase(found);
+          stale.push_back(false);
+          ++result.num_reused;
+        }
+        else
+        {
+          segments_.push_back(parse_segment(std::move(key)));
+          stale.push_back(true);
+          changed.insert(segments_.back()->names.begin(), segments_.back()->names.end());
+          ++result.num_parsed;
+        }
+      }
+
+      // what remains of the previous version was edited or deleted
+      for(auto& [key, s] : previous)
+      {
+        remove_modules(*s);
+        changed.insert(s->names.begin(), s->names.end());
+      }
+      previous.clear();
+
+      // code which calls a changed function must be regenerated, which changes
+      // the function it belongs to in turn, so find stale segments transitively
+      std::unordered_map<symbol, std::vector<std::size_t>> callers;
+      for(std::size_t i = 0; i < segments_.size(); ++i)
+      {
+        for(symbol callee : segments_[i]->callees)
+        {
+          callers[callee].push_back(i);
+        }
+      }
+
+      std::vector<symbol> worklist(changed.begin(), changed.end());
+      while(!worklist.empty())
+      {
+        symbol name = worklist.back();
+        worklist.pop_back();
+
+        for(std::size_t i : callers[name])
+        {
+          if(!stale[i])
+          {
+            stale[i] = true;
+            worklist.insert(worklist.end(), segments_[i]->names.begin(), segments_[i]->names.end());
+          }
+        }
+      }
+
+      // discard stale code before any is regenerated, so that nothing new links against it,
+      // and declare stale prototypes up front, so that stale segments may call functions
+      // defined after them, as they could before
+      for(std::size_t i = 0; i < segments_.size(); ++i)
+      {
+        if(stale[i])
+        {
+          remove_modules(*segments_[i]);
+          for_each_prototype(*segments_[i], [&](const function_prototype& prototype)
+          {
+            generator_.redeclare(prototype);
+          });
+        }
+      }
+
+      // bring stale segments up to date in source order
+      for(std::size_t i = 0; i < segments_.size(); ++i)
+      {
+        if(stale[i])
+        {
+          try
+          {
+            update(*segments_[i], result);
+          }
+          catch(...)
+          {
+            // forget the segments we didn't bring up to date, so they are retried next time
+            for(std::size_t j = i; j < segments_.size(); ++j)
+            {
+              if(stale[j])
+              {
+                remove_modules(*segments_[j]);
+                segments_[j]->key.clear();
+              }
+            }
+
+            throw;
+          }
+        }
+      }
+
+      result.num_segments = segments_.size();
+      return result;
+    }
+
+  private:
+    struct segment
+    {
+      // the segment's text with comments removed and whitespace collapsed
+      std::string key;
+
+      // the segment's statements, with top-level expressions wrapped in anonymous functions
+      std::unique_ptr<program> statements;
+
+      // the functions the segment defines or declares
+      std::vector<symbol> names;
+
+      // the functions called by the segment's statements
+      std::vector<symbol> callees;
+
+      // the modules holding the segment's compiled definitions
+      std::vector<jit_compiler::module_handle_t> modules;
+    };
+
+    // removes comments, and collapses runs of whitespace into a single space
+    static std::string make_key(std::string_view text)
+    {
+      std::string result;
+
+      const char* first = text.data();
+      const char* last = text.data() + text.size();
+      while((first = find_non_space(first, last)) != last)
+      {
+        if(*first == '#')
+        {
+          first = find_line_end(first, last);
+          continue;
+        }
+
+        const char* word_end = first;
+        while(word_end != last and !is_space(*word_end) and *word_end != '#')
+        {
+          ++word_end;
+        }
+
+        if(!result.empty())
+        {
+          result += ' ';
+        }
+        result.append(first, word_end);
+        first = word_end;
+      }
+
+      return result;
+    }
+
+    std::unique_ptr<segment> parse_segment(std::string&& key)
+    {
+      auto result = std::make_unique<segment>();
+      result->key = std::move(key);
+
+      parser p(source_buffer::from_view(result->key), parser_options::quiet());
+      result->statements = std::make_unique<program>(p.parse_program());
+
+      for(top_level_statement& statement : result->statements->statements())
+      {
+        if(expression* e = std::get_if<expression>(&statement))
+        {
+          // wrap the expression so that it can be evaluated again later without being consumed
+          expression body = std::move(*e);
+          statement = function(function_prototype(intern("__anon_expr"), std::vector<symbol>()), std::move(body));
+        }
+
+        std::visit(overloaded(
+          [&](const function& f)
+          {
+            if(f.prototype().name() != intern("__anon_expr"))
+            {
+              result->names.push_back(f.prototype().name());
+            }
+
+            for_each_callee(f.body(), [&](symbol callee)
+            {
+              result->callees.push_back(callee);
+            });
+          },
+          [&](const function_prototype& fp)
+          {
+            result->names.push_back(fp.name());
+          },
+          [](const expression&)
+          {
+            // expressions were wrapped above
+          }),
+          statement
+        );
+      }
+
+      return result;
+    }
+
+    template<class Function>
+    static void for_each_prototype(const segment& s, Function f)
+    {
+      for(const top_level_statement& statement : s.statements->statements())
+      {
+        if(const function* def = std::get_if<function>(&statement))
+        {
+          f(def->prototype());
+        }
+        else if(const function_prototype* fp = std::get_if<function_prototype>(&statement))
+        {
+          f(*fp);
+        }
+      }
+    }
+
+    void remove_modules(segment& s)
+    {
+      for(jit_compiler::module_handle_t module : s.modules)
+      {
+        compiler_.remove_module(module);
+      }
+
+      s.modules.clear();
+    }
+
+    // regenerates and recompiles s, and evaluates its top-level expressions
+    void update(segment& s, load_statistics& statistics)
+    {
+      ++statistics.num_recompiled;
+
+      for(const top_level_statement& statement : s.statements->statements())
+      {
+        if(const function_prototype* fp = std::get_if<function_prototype>(&statement))
+        {
+          generator_.redeclare(*fp);
+          continue;
+        }
+
+        const function& f = std::get<function>(statement);
+        generator_.visitor()(f);
+
+        // specializations may be called by later segments, so they don't belong to this one
+        specializations_.update(generator_, compiler_);
+
+        auto module = compiler_.add_module(generator_.release_module());
+
+        if(f.prototype().name() != intern("__anon_expr"))
+        {
+          s.modules.push_back(module);
+          continue;
+        }
+
+        // evaluate the expression
+        auto symbol = compiler_.find_symbol("__anon_expr");
+        if(!symbol)
+        {
+          compiler_.remove_module(module);
+          throw std::runtime_error("Function not found");
+        }
+
+        double (*f_ptr)() = reinterpret_cast<double(*)()>(*symbol.getAddress());
+        double value = f_ptr();
+        std::cout << "Evaluated to " << value << std::endl;
+        ++statistics.num_evaluated;
+
+        compiler_.remove_module(module);
+      }
+    }
+
+    generator generator_;
+    jit_compiler compiler_;
+    specialization_modules specializations_;
+
+    // the segments of the most recently loaded version, in source order
+    std::vector<std::unique_ptr<segment>> segments_;
+};
+
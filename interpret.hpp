@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
 #include "parser.hpp"
+#include "parallel_parser.hpp"
 #include "jit_compiler.hpp"
 #include "generator.hpp"
 #include "overloaded.hpp"
+#include "specialization_modules.hpp"
 
-void handle_statement(generator& gen, jit_compiler& compiler, const top_level_statement& statement)
+void handle_statement(generator& gen, jit_compiler& compiler, specialization_modules& specializations, top_level_statement&& statement)
 {
   std::visit(overloaded(
     [&](const function& f)
@@ -16,7 +22,8 @@ void handle_statement(generator& gen, jit_compiler& compiler, const top_level_st
       // print IR
       f_ir.print(llvm::errs());
 
-      // give the module to the compiler 
+      // give the module to the compiler, after the specializations it calls, and forget those it made stale
+      specializations.update(gen, compiler);
       compiler.add_module(gen.release_module());
     },
     [&](const function_prototype& fp)
@@ -27,15 +34,16 @@ void handle_statement(generator& gen, jit_compiler& compiler, const top_level_st
       // print IR
       f_ir.print(llvm::errs());
     },
-    [&](const expression& e)
+    [&](expression& e)
     {
       // create an anonymous function for this expression
-      function f(function_prototype("__anon_expr", std::vector<std::string>()), e);
+      function f(function_prototype(intern("__anon_expr"), std::vector<symbol>()), std::move(e));
 
       auto& f_ir = gen.visitor()(f);
       f_ir.print(llvm::errs());
 
-      // give the module to the compiler
+      // give the module to the compiler, after the specializations it calls, which later expressions may call too
+      specializations.update(gen, compiler);
       auto module_handle = compiler.add_module(gen.release_module());
 
       // ask the compiler for __anon_expr's symbol
@@ -62,21 +70,30 @@ void handle_statement(generator& gen, jit_compiler& compiler, const top_level_st
   );
 }
 
-void interpret()
+void interpret(source_buffer source)
 {
-  parser p;
-  generator gen;
-  jit_compiler compiler;
+  parser p(std::move(source));
+
+  // most interactive definitions are called once, so compile them quickly and only optimize the hot ones
+  target_context target(codegen_options::tiered_compilation());
+  generator gen(target);
+  jit_compiler compiler(target);
+  specialization_modules specializations;
 
   while(p.current_token() != token(char(EOF)))
   {
     if(p.current_token() != token(';'))
     {
-      // parse a statement
-      top_level_statement statement = p.parse_top_level_statement();
+      {
+        // parse a statement
+        top_level_statement statement = p.parse_top_level_statement();
+
+        // handle it
+        handle_statement(gen, compiler, specializations, std::move(statement));
+      }
 
-      // handle it
-      handle_statement(gen, compiler, statement);
+      // free the statement's nodes all at once, keeping their memory for the next statement's
+      p.reset_arena();
     }
     else
     {
@@ -86,3 +103,96 @@ void interpret()
   }
 }
 
+// interprets an already parsed program
+void interpret(program&& prog)
+{
+  // files are often preludes which define many more functions than they call, so compile each on its first call
+  target_context target(codegen_options::lazy_compilation());
+  generator gen(target);
+  jit_compiler compiler(target);
+  specialization_modules specializations;
+
+  for(top_level_statement& statement : prog.statements())
+  {
+    handle_statement(gen, compiler, specializations, std::move(statement));
+  }
+}
+
+
+// interprets an already parsed program as a single module
+//
+// every definition is visible to the module pipeline at once, and only the top-level
+// expressions are called from outside it, so helpers can be inlined into their callers
+// and discarded. the program can't be extended afterwards, unlike at the REPL
+//
+// a module holds one definition of each function, so a program which defines a function
+// more than once is rejected before anything is generated, since expressions between its
+// definitions would call the wrong one
+void interpret_whole_program(program&& prog)
+{
+  std::unordered_set<symbol> defined;
+  for(const top_level_statement& statement : prog.statements())
+  {
+    if(const function* f = std::get_if<function>(&statement))
+    {
+      if(!defined.insert(f->prototype().name()).second)
+      {
+        throw std::runtime_error(std::string("'") + f->prototype().name().str() + "' is defined more than once, which a whole program can't be");
+      }
+    }
+  }
+
+  generator gen;
+  jit_compiler compiler;
+
+  std::vector<std::string> entry_points;
+
+  for(top_level_statement& statement : prog.statements())
+  {
+    std::visit(overloaded(
+      [&](const function& f)
+      {
+        gen.visitor()(f);
+      },
+      [&](const function_prototype& fp)
+      {
+        gen.redeclare(fp);
+      },
+      [&](expression& e)
+      {
+        // each expression gets an entry point of its own, evaluated in order below
+        std::string name = "__anon_expr." + std::to_string(entry_points.size());
+        function f(function_prototype(intern(name), std::vector<symbol>()), std::move(e));
+
+        gen.visitor()(f);
+        entry_points.push_back(std::move(name));
+      }),
+      statement
+    );
+  }
+
+  gen.internalize([&](llvm::StringRef name)
+  {
+    return std::find(entry_points.begin(), entry_points.end(), name) != entry_points.end();
+  });
+
+  std::unique_ptr<llvm::Module> m = gen.release_module();
+  m->print(llvm::errs(), nullptr);
+
+  auto module_handle = compiler.add_module(std::move(m));
+
+  for(const std::string& name : entry_points)
+  {
+    auto symbol = compiler.find_symbol(name);
+    if(!symbol)
+    {
+      compiler.remove_module(module_handle);
+      throw std::runtime_error("Function not found");
+    }
+
+    double (*f_ptr)() = reinterpret_cast<double(*)()>(*symbol.getAddress());
+    std::cout << "Evaluated to " << f_ptr() << std::endl;
+  }
+
+  compiler.remove_module(module_handle);
+}
@@ -3,93 +3,358 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
 #include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
 #include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/Mangler.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/Linker/Linker.h>
+#include "target.hpp"
+#include "optimizer.hpp"
+#include "tiering.hpp"
+#include "memoization.hpp"
 
 
+struct jit_statistics
+{
+  // functions whose compilation was put off until their first call
+  std::size_t num_deferred = 0;
+
+  // functions compiled when they were first called
+  std::size_t num_compiled_on_first_call = 0;
+
+  // functions compiled quickly, with minimal optimization
+  std::size_t num_first_tier_compiles = 0;
+
+  // functions whose call counts crossed the threshold
+  std::size_t num_tier_up_requests = 0;
+
+  // functions recompiled with the full pipeline whose call sites were switched over to the new code
+  std::size_t num_recompiled = 0;
+
+  // recompilations thrown away because their function was redefined or removed in the meantime
+  std::size_t num_discarded = 0;
+
+  // calls to memoized functions whose results were cached, or weren't, summed over every function
+  std::uint64_t num_memo_hits = 0;
+  std::uint64_t num_memo_misses = 0;
+
+  // cached results replaced by newer ones
+  std::uint64_t num_memo_evictions = 0;
+};
+
+
+// a jit_compiler turns modules into machine code in this process
+//
+// when its target asks for lazy compilation, a module's functions are called
+// through indirect stubs which compile the module on its first call, so
+// functions which are never called are never compiled
+//
+// when its target asks for tiered compilation, each function is first compiled
+// without optimization, and every call to it, from generated code or through
+// find_symbol(), goes through an indirect stub. functions which first-tier code
+// reports as hot are recompiled on a background thread with the full pipeline,
+// in an LLVMContext of their own, and their stubs are switched over to the new code
+//
+// memoized functions get their memo_tables from the jit_compiler, which forgets
+// every cached result when a function is defined, since it may be a redefinition
 class jit_compiler
 {
   private:
-    using compile_layer_t = llvm::orc::IRCompileLayer<llvm::orc::RTDyldObjectLinkingLayer, llvm::orc::SimpleCompiler>;
+    using object_layer_t = llvm::orc::RTDyldObjectLinkingLayer;
+    using compile_layer_t = llvm::orc::IRCompileLayer<object_layer_t, llvm::orc::SimpleCompiler>;
 
   public:
-    using module_handle_t = compile_layer_t::ModuleHandleT;
+    // identifies a module, whether or not it has been compiled yet
+    using module_handle_t = std::size_t;
 
-    jit_compiler()
-      : target_machine_(llvm::EngineBuilder().selectTarget()),
-        data_layout_(target_machine_->createDataLayout()),
+    explicit jit_compiler(target_context& target = target_context::host())
+      : target_(&target),
         object_layer_([]()
         {
           return std::make_shared<llvm::SectionMemoryManager>();
         }),
-        compile_layer_(object_layer_, llvm::orc::SimpleCompiler(*target_machine_))
+        compile_layer_(object_layer_, llvm::orc::SimpleCompiler(target_->target_machine()))
     {
       llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+      const llvm::Triple& triple = target.target_machine().getTargetTriple();
+
+      // generated code calls us back, passing our own address
+      tier_up_context_symbol_ = mangle(tier_up_context_name);
+      tier_up_function_symbol_ = mangle(tier_up_function_name);
+      memo_table_function_symbol_ = mangle(memo_table_function_name);
+      memo_find_function_symbol_ = mangle(memo_find_function_name);
+      memo_insert_function_symbol_ = mangle(memo_insert_function_name);
+
+      if(target.options().lazy or target.options().tiered)
+      {
+        stubs_ = llvm::orc::createLocalIndirectStubsManagerBuilder(triple)();
+      }
+
+      if(target.options().lazy)
+      {
+        compile_callbacks_ = llvm::orc::createLocalCompileCallbackManager(triple, 0);
+      }
+
+      if(target.options().tiered)
+      {
+        // the final tier gets a target machine of its own, since the first tier's isn't thread safe
+        final_target_ = std::make_unique<target_context>(target.options().final_tier());
+        tier_up_thread_ = std::thread([this]
+        {
+          recompile_hot_functions();
+        });
+      }
+    }
+
+    jit_compiler(const jit_compiler&) = delete;
+    jit_compiler& operator=(const jit_compiler&) = delete;
+
+    ~jit_compiler()
+    {
+      if(tier_up_thread_.joinable())
+      {
+        {
+          std::lock_guard<std::mutex> lock(tier_up_mutex_);
+          stopping_ = true;
+        }
+
+        tier_up_requested_.notify_one();
+        tier_up_thread_.join();
+      }
     }
 
     llvm::JITSymbol find_symbol(const std::string& name)
     {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
       return find_mangled_symbol(mangle(name));
     }
 
     module_handle_t add_module(std::unique_ptr<llvm::Module> m)
     {
-      auto resolver = llvm::orc::createLambdaResolver(
-        [&](const std::string& name)
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+      module_handle_t result = next_module_handle_++;
+      loaded_module& entry = modules_[result];
+
+      // note the functions to call through stubs
+      if(stubs_)
+      {
+        for(const llvm::Function& f : *m)
         {
-          if(auto symbol = find_mangled_symbol(name))
+          // anonymous expressions are called right away, and only once, and internal functions can't be called from outside
+          if(!f.isDeclaration() and !f.hasLocalLinkage() and f.getName() != "__anon_expr")
           {
-            return symbol;
+            entry.stubbed_names.push_back(mangle(f.getName().str()));
           }
+        }
+      }
 
-          return llvm::JITSymbol(nullptr);
-        },
-        [](const std::string& name)
+      // the module may redefine a memoized function, or a function one calls
+      if(std::any_of(m->begin(), m->end(), [](const llvm::Function& f)
+      {
+        return !f.isDeclaration() and !f.hasLocalLinkage() and f.getName() != "__anon_expr";
+      }))
+      {
+        clear_memo_tables();
+      }
+
+      entry.ir = std::move(m);
+
+      if(compile_callbacks_ and !entry.stubbed_names.empty())
+      {
+        defer_compilation(result);
+      }
+      else
+      {
+        compile(result);
+      }
+
+      return result;
+    }
+
+    void remove_module(module_handle_t module)
+    {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+      // forget the functions it defined, along with their recompiled code
+      for(auto f = stubbed_functions_.begin(); f != stubbed_functions_.end();)
+      {
+        if(f->second.module == module)
         {
-          return nullptr;
+          remove_final_tier(f->second);
+          f = stubbed_functions_.erase(f);
         }
-      );
+        else
+        {
+          ++f;
+        }
+      }
+
+      // erase the module from the compile layer, if it got that far, and from our list
+      auto entry = modules_.find(module);
+      if(entry->second.compiled)
+      {
+        (void)compile_layer_.removeModule(*entry->second.compiled);
+      }
+
+      modules_.erase(entry);
+    }
 
-      // move the module to the compile layer
-      module_handle_t result = *compile_layer_.addModule(std::move(m), std::move(resolver));
+    jit_statistics statistics() const
+    {
+      jit_statistics result;
+
+      {
+        std::lock_guard<std::mutex> lock(tier_up_mutex_);
+        result = statistics_;
+      }
 
-      // note the handle
-      module_handles_.push_back(result);
+      std::lock_guard<std::mutex> lock(memo_mutex_);
+      for(const auto& table : memo_tables_)
+      {
+        result.num_memo_hits += table.second->hits();
+        result.num_memo_misses += table.second->misses();
+        result.num_memo_evictions += table.second->evictions();
+      }
 
-      // return it
       return result;
     }
 
-    void remove_module(module_handle_t module)
+    // 0 if the named function's calls go to its first-tier code, 1 if they go to its recompiled code,
+    // or -1 if it isn't tiered or hasn't been compiled yet
+    int tier(const std::string& name)
     {
-      // erase the module from our list
-      module_handles_.erase(std::find(module_handles_.begin(), module_handles_.end(), module));
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+      auto found = stubbed_functions_.find(mangle(name));
+      if(!target_->options().tiered or found == stubbed_functions_.end() or !modules_.at(found->second.module).compiled)
+      {
+        return -1;
+      }
 
-      // and the compile layer
-      (void)compile_layer_.removeModule(module);
+      return found->second.final_tier ? 1 : 0;
     }
 
   private:
+    struct loaded_module
+    {
+      // the module's IR, until it is compiled
+      std::unique_ptr<llvm::Module> ir;
+
+      // the compiled module
+      std::optional<compile_layer_t::ModuleHandleT> compiled;
+
+      // the mangled names of the functions it defines which are called through stubs
+      std::vector<std::string> stubbed_names;
+    };
+
+    struct stubbed_function
+    {
+      // the module which defines the function, and, when it is tiered, its IR before it was compiled
+      module_handle_t module;
+      std::shared_ptr<const std::string> bitcode;
+
+      // the object holding the function's recompiled code
+      std::optional<object_layer_t::ObjHandleT> final_tier;
+
+      // incremented whenever the function is redefined, so that a recompilation of an older definition is thrown away
+      std::size_t generation = 0;
+
+      // the callees whose IR was linked into the recompiled code, by mangled name, and their generations
+      std::vector<std::pair<std::string, std::size_t>> relinked_callees;
+    };
+
+    std::shared_ptr<llvm::JITSymbolResolver> make_resolver()
+    {
+      return llvm::orc::createLambdaResolver(
+        [this](const std::string& name)
+        {
+          if(auto symbol = find_mangled_symbol(name))
+          {
+            return symbol;
+          }
+
+          return llvm::JITSymbol(nullptr);
+        },
+        [](const std::string& name)
+        {
+          return nullptr;
+        }
+      );
+    }
+
     llvm::JITSymbol find_mangled_symbol(const std::string& name)
     {
       const bool exported_symbols_only = true;
 
-      // search modules in reverse order
-      for(auto handle = module_handles_.rbegin();
-          handle != module_handles_.rend();
-          ++handle)
+      // first-tier code and memoized functions call us back, passing our own address
+      if(name == tier_up_context_symbol_)
+      {
+        return llvm::JITSymbol(address_of(this), llvm::JITSymbolFlags::Exported);
+      }
+
+      if(name == tier_up_function_symbol_)
+      {
+        return llvm::JITSymbol(address_of(&tier_up), llvm::JITSymbolFlags::Exported);
+      }
+
+      if(name == memo_table_function_symbol_)
+      {
+        return llvm::JITSymbol(address_of(&memo_table_for), llvm::JITSymbolFlags::Exported);
+      }
+
+      if(name == memo_find_function_symbol_)
+      {
+        return llvm::JITSymbol(address_of(&memo_find), llvm::JITSymbolFlags::Exported);
+      }
+
+      if(name == memo_insert_function_symbol_)
+      {
+        return llvm::JITSymbol(address_of(&memo_insert), llvm::JITSymbolFlags::Exported);
+      }
+
+      if(stubs_)
+      {
+        // lazy and tiered functions are always called through their stubs, so they can be switched over
+        if(stubbed_functions_.count(name))
+        {
+          return stubs_->findStub(name, exported_symbols_only);
+        }
+      }
+
+      // search compiled modules in reverse order
+      for(auto entry = modules_.rbegin();
+          entry != modules_.rend();
+          ++entry)
       {
-        if(auto symbol = compile_layer_.findSymbolIn(*handle, name, exported_symbols_only))
+        if(entry->second.compiled)
         {
-          return symbol;
+          if(auto symbol = compile_layer_.findSymbolIn(*entry->second.compiled, name, exported_symbols_only))
+          {
+            return symbol;
+          }
         }
       }
 
@@ -103,19 +368,594 @@ class jit_compiler
       return nullptr;
     }
 
+    template<class Pointer>
+    static llvm::JITTargetAddress address_of(Pointer ptr)
+    {
+      return static_cast<llvm::JITTargetAddress>(reinterpret_cast<std::uintptr_t>(ptr));
+    }
+
     std::string mangle(const std::string& name) const
     {
       std::string result;
       llvm::raw_string_ostream mangled_name_stream(result);
-      llvm::Mangler::getNameWithPrefix(mangled_name_stream, name, data_layout_);
+      llvm::Mangler::getNameWithPrefix(mangled_name_stream, name, target_->data_layout());
+      return result;
+    }
+
+    static std::shared_ptr<const std::string> write_bitcode(const llvm::Module& m)
+    {
+      auto result = std::make_shared<std::string>();
+      llvm::raw_string_ostream os(*result);
+      llvm::WriteBitcodeToFile(&m, os);
+      os.flush();
+      return result;
+    }
+
+    // points the named function's stub at address, creating the stub if need be
+    void point_stub_at(const std::string& name, llvm::JITTargetAddress address)
+    {
+      if(stubs_->findStub(name, false))
+      {
+        llvm::cantFail(stubs_->updatePointer(name, address));
+      }
+      else
+      {
+        llvm::cantFail(stubs_->createStub(name, address, llvm::JITSymbolFlags::Exported));
+      }
+    }
+
+    // notes that the named function is now defined by module
+    // a redefinition replaces the function's recompiled code, too, along with recompiled code which inlined it
+    stubbed_function& define(const std::string& name, module_handle_t module)
+    {
+      // only the callers which linked the function in are visited, so a definition costs nothing when none have
+      auto callers = relinking_callers_.find(name);
+      if(callers != relinking_callers_.end())
+      {
+        for(const std::string& caller_name : callers->second)
+        {
+          // the caller may have been recompiled since without the function, or removed
+          auto caller = stubbed_functions_.find(caller_name);
+          if(caller != stubbed_functions_.end() and
+             std::any_of(caller->second.relinked_callees.begin(), caller->second.relinked_callees.end(), [&](const auto& callee)
+             {
+               return callee.first == name;
+             }))
+          {
+            fall_back_to_first_tier(caller_name, caller->second);
+          }
+        }
+
+        // callers which link the function in again are recorded again
+        relinking_callers_.erase(callers);
+      }
+
+      stubbed_function& result = stubbed_functions_[name];
+      remove_final_tier(result);
+      result.module = module;
+      result.bitcode.reset();
+      ++result.generation;
       return result;
     }
 
-    std::unique_ptr<llvm::TargetMachine> target_machine_;
-    llvm::DataLayout data_layout_;
-    llvm::orc::RTDyldObjectLinkingLayer object_layer_;
+    // points a recompiled function's stub back at its first-tier code, and asks for it to be recompiled again
+    // its first-tier code has already counted past the threshold, so it won't ask by itself
+    void fall_back_to_first_tier(const std::string& name, stubbed_function& f)
+    {
+      if(f.final_tier)
+      {
+        point_stub_at(name, *compile_layer_.findSymbolIn(*modules_.at(f.module).compiled, name, false).getAddress());
+        remove_final_tier(f);
+        ++f.generation;
+
+        {
+          std::lock_guard<std::mutex> lock(tier_up_mutex_);
+          tier_up_requests_.push_back(name);
+        }
+
+        tier_up_requested_.notify_one();
+      }
+    }
+
+    // compiles a module, and points the stubs of the functions it defines at their code
+    void compile(module_handle_t module)
+    {
+      loaded_module& entry = modules_.at(module);
+
+      // keep the IR of tiered functions for recompilation, before the compile layer takes the module
+      std::shared_ptr<const std::string> bitcode;
+      if(target_->options().tiered and !entry.stubbed_names.empty())
+      {
+        bitcode = write_bitcode(*entry.ir);
+      }
+
+      entry.compiled = *compile_layer_.addModule(std::move(entry.ir), make_resolver());
+
+      // a later module may have defined some of the functions again while this one was deferred,
+      // so their stubs are left pointing at the newer definitions
+      std::size_t num_pointed = 0;
+      for(const std::string& name : entry.stubbed_names)
+      {
+        auto found = stubbed_functions_.find(name);
+        if(found != stubbed_functions_.end() and module < found->second.module)
+        {
+          continue;
+        }
+
+        point_stub_at(name, *compile_layer_.findSymbolIn(*entry.compiled, name, false).getAddress());
+        define(name, module).bitcode = bitcode;
+        ++num_pointed;
+      }
+
+      if(bitcode)
+      {
+        std::lock_guard<std::mutex> lock(tier_up_mutex_);
+        statistics_.num_first_tier_compiles += num_pointed;
+      }
+    }
+
+    // points the stubs of the functions a module defines at callbacks which compile it
+    void defer_compilation(module_handle_t module)
+    {
+      loaded_module& entry = modules_.at(module);
+
+      for(const std::string& name : entry.stubbed_names)
+      {
+        auto callback = compile_callbacks_->getCompileCallback();
+        callback.setCompileAction([this, module, name]
+        {
+          return compile_on_first_call(module, name);
+        });
+
+        point_stub_at(name, callback.getAddress());
+        define(name, module);
+      }
+
+      std::lock_guard<std::mutex> lock(tier_up_mutex_);
+      statistics_.num_deferred += entry.stubbed_names.size();
+    }
+
+    // called through a stub on the interpreter's thread, returns the address to call instead
+    llvm::JITTargetAddress compile_on_first_call(module_handle_t module, const std::string& name)
+    {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+      auto entry = modules_.find(module);
+      if(entry == modules_.end())
+      {
+        // the module was removed, but a caller still held onto its stub
+        // there's nothing to call, and returning would jump to address 0, so fail here, where it can be diagnosed
+        llvm::report_fatal_error("Called '" + name + "', whose module was removed before it was compiled");
+      }
+
+      // another function of the module may have been called first
+      if(!entry->second.compiled)
+      {
+        compile(module);
+
+        std::lock_guard<std::mutex> statistics_lock(tier_up_mutex_);
+        ++statistics_.num_compiled_on_first_call;
+      }
+
+      return *compile_layer_.findSymbolIn(*entry->second.compiled, name, false).getAddress();
+    }
+
+    void remove_final_tier(stubbed_function& f)
+    {
+      if(f.final_tier)
+      {
+        llvm::cantFail(object_layer_.removeObject(*f.final_tier));
+        f.final_tier.reset();
+        f.relinked_callees.clear();
+      }
+    }
+
+    // called by a memoized function the first time it runs
+    // the table outlives the function's module, and is reused by its redefinitions with as many parameters
+    // one with a different number gets a table of its own, since the old one may still be used by code which
+    // was linked against the old definition
+    static void* memo_table_for(void* jit, const char* name, std::uint64_t num_parameters)
+    {
+      jit_compiler& self = *static_cast<jit_compiler*>(jit);
+      const codegen_options& options = self.target_->options();
+
+      std::lock_guard<std::mutex> lock(self.memo_mutex_);
+
+      std::unique_ptr<memo_table>& result = self.memo_tables_[std::make_pair(std::string(name), num_parameters)];
+      if(!result)
+      {
+        result = std::make_unique<memo_table>(num_parameters, options.memo_capacity, options.memo_eviction_policy);
+      }
+
+      return result.get();
+    }
+
+    // memoized functions look each call's arguments up, and cache the result when they weren't found
+    static std::int32_t memo_find(void* table, const double* arguments, double* result)
+    {
+      return static_cast<memo_table*>(table)->find(arguments, *result);
+    }
+
+    static void memo_insert(void* table, const double* arguments, double result)
+    {
+      static_cast<memo_table*>(table)->insert(arguments, result);
+    }
+
+    void clear_memo_tables()
+    {
+      std::lock_guard<std::mutex> lock(memo_mutex_);
+      for(auto& table : memo_tables_)
+      {
+        table.second->clear();
+      }
+    }
+
+    // called by first-tier code on the interpreter's thread, so it only queues the work
+    static void tier_up(void* jit, const char* name)
+    {
+      jit_compiler& self = *static_cast<jit_compiler*>(jit);
+
+      {
+        std::lock_guard<std::mutex> lock(self.tier_up_mutex_);
+        self.tier_up_requests_.push_back(self.mangle(name));
+        ++self.statistics_.num_tier_up_requests;
+      }
+
+      self.tier_up_requested_.notify_one();
+    }
+
+    void recompile_hot_functions()
+    {
+      optimizer final_optimizer(*final_target_);
+
+      while(true)
+      {
+        std::string name;
+
+        {
+          std::unique_lock<std::mutex> lock(tier_up_mutex_);
+          tier_up_requested_.wait(lock, [&]
+          {
+            return stopping_ or !tier_up_requests_.empty();
+          });
+
+          if(stopping_)
+          {
+            return;
+          }
+
+          name = std::move(tier_up_requests_.front());
+          tier_up_requests_.pop_front();
+        }
+
+        recompile(final_optimizer, name);
+      }
+    }
+
+    void recompile(optimizer& final_optimizer, const std::string& name)
+    {
+      auto discard = [&]
+      {
+        std::lock_guard<std::mutex> lock(tier_up_mutex_);
+        ++statistics_.num_discarded;
+      };
+
+      std::shared_ptr<const std::string> bitcode;
+      std::size_t generation = 0;
+
+      {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        auto found = stubbed_functions_.find(name);
+        if(found == stubbed_functions_.end() or !found->second.bitcode or found->second.final_tier)
+        {
+          return discard();
+        }
+
+        bitcode = found->second.bitcode;
+        generation = found->second.generation;
+      }
+
+      // optimize and generate code without holding the lock, so the interpreter isn't held up
+      // the generator's context isn't thread safe, so the module is read into a context of our own
+      llvm::LLVMContext context;
+      llvm::Expected<std::unique_ptr<llvm::Module>> m = llvm::parseBitcodeFile(llvm::MemoryBufferRef(*bitcode, name), context);
+      if(!m)
+      {
+        llvm::consumeError(m.takeError());
+        return discard();
+      }
+
+      std::vector<std::pair<std::string, std::size_t>> relinked_callees;
+      if(target_->options().relink_hot_call_graph)
+      {
+        relink_callees(**m, relinked_callees);
+      }
+
+      remove_tier_up_calls(**m);
+      apply_marked_effects(**m);
+
+      for(llvm::Function& f : **m)
+      {
+        if(!f.isDeclaration())
+        {
+          final_optimizer.optimize(f);
+        }
+      }
+
+      final_optimizer.optimize(**m);
+
+      auto object = std::make_shared<llvm::object::OwningBinary<llvm::object::ObjectFile>>(
+        llvm::orc::SimpleCompiler(final_target_->target_machine())(**m)
+      );
+
+      // link the new code and switch the function's stub over to it
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+      auto is_current = [&](const std::string& name, std::size_t generation)
+      {
+        auto found = stubbed_functions_.find(name);
+        return found != stubbed_functions_.end() and found->second.generation == generation;
+      };
+
+      if(!is_current(name, generation) or
+         !std::all_of(relinked_callees.begin(), relinked_callees.end(), [&](const auto& callee)
+         {
+           return is_current(callee.first, callee.second);
+         }))
+      {
+        return discard();
+      }
+
+      auto found = stubbed_functions_.find(name);
+
+      object_layer_t::ObjHandleT handle = llvm::cantFail(object_layer_.addObject(std::move(object), make_resolver()));
+
+      llvm::Expected<llvm::JITTargetAddress> address = object_layer_.findSymbolIn(handle, name, false).getAddress();
+      if(!address)
+      {
+        llvm::consumeError(address.takeError());
+        llvm::cantFail(object_layer_.removeObject(handle));
+        return discard();
+      }
+
+      llvm::cantFail(stubs_->updatePointer(name, *address));
+      found->second.final_tier = handle;
+      found->second.relinked_callees = std::move(relinked_callees);
+
+      for(const auto& callee : found->second.relinked_callees)
+      {
+        relinking_callers_[callee.first].insert(name);
+      }
+
+      std::lock_guard<std::mutex> statistics_lock(tier_up_mutex_);
+      ++statistics_.num_recompiled;
+    }
+
+    // links private copies of the tiered functions m calls, and of the ones they call, into m, so that the
+    // module pipeline may inline them. notes the callees linked, and their generations
+    void relink_callees(llvm::Module& m, std::vector<std::pair<std::string, std::size_t>>& relinked)
+    {
+      // stop after a few callees, so that recompilation stays quick
+      const std::size_t max_relinked_callees = 16;
+
+      // walk the call graph breadth first, by the names of the functions m declares
+      std::deque<std::string> callees;
+      std::unordered_set<std::string> seen;
+      auto note_callees = [&]
+      {
+        for(const llvm::Function& f : m)
+        {
+          if(f.isDeclaration() and f.getName() != tier_up_function_name and seen.insert(f.getName().str()).second)
+          {
+            callees.push_back(f.getName().str());
+          }
+        }
+      };
+
+      note_callees();
+
+      while(!callees.empty() and relinked.size() < max_relinked_callees)
+      {
+        std::string callee = std::move(callees.front());
+        callees.pop_front();
+
+        std::string mangled = mangle(callee);
+        std::shared_ptr<const std::string> bitcode;
+        std::size_t generation = 0;
+
+        {
+          std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+          auto found = stubbed_functions_.find(mangled);
+          if(found == stubbed_functions_.end() or !found->second.bitcode)
+          {
+            // functions from the host, or which haven't been compiled, stay where they are
+            continue;
+          }
+
+          bitcode = found->second.bitcode;
+          generation = found->second.generation;
+        }
+
+        llvm::Expected<std::unique_ptr<llvm::Module>> callee_module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(*bitcode, mangled), m.getContext());
+        if(!callee_module)
+        {
+          llvm::consumeError(callee_module.takeError());
+          continue;
+        }
+
+        std::vector<std::string> defined;
+        for(const llvm::Function& f : **callee_module)
+        {
+          if(!f.isDeclaration() and !f.hasLocalLinkage())
+          {
+            defined.push_back(f.getName().str());
+          }
+        }
+
+        if(llvm::Linker::linkModules(m, std::move(*callee_module)))
+        {
+          continue;
+        }
+
+        // the copies are private to m, so they don't clash with the definitions the stubs lead to
+        for(const std::string& name : defined)
+        {
+          m.getFunction(name)->setLinkage(llvm::GlobalValue::InternalLinkage);
+        }
+
+        relinked.emplace_back(std::move(mangled), generation);
+        note_callees();
+      }
+    }
+
+    // recompiled code needn't count its calls
+    static void remove_tier_up_calls(llvm::Module& m)
+    {
+      if(llvm::Function* tier_up = m.getFunction(tier_up_function_name))
+      {
+        // the callback is only ever called directly
+        while(!tier_up->use_empty())
+        {
+          llvm::cast<llvm::Instruction>(tier_up->user_back())->eraseFromParent();
+        }
+
+        tier_up->eraseFromParent();
+      }
+
+      // without the callback, the counters are useless, and would keep pure functions from being readnone
+      for(llvm::Function& f : m)
+      {
+        llvm::GlobalVariable* counter = m.getGlobalVariable((f.getName() + call_counter_suffix).str(), true);
+        if(!counter)
+        {
+          continue;
+        }
+
+        // the counter is only loaded and stored, so loads become zeros, which fold away
+        while(!counter->use_empty())
+        {
+          llvm::Instruction* user = llvm::cast<llvm::Instruction>(counter->user_back());
+          if(user->getType() != llvm::Type::getVoidTy(m.getContext()))
+          {
+            user->replaceAllUsesWith(llvm::Constant::getNullValue(user->getType()));
+          }
+
+          user->eraseFromParent();
+        }
+
+        counter->eraseFromParent();
+      }
+    }
+
+    // gives the module's definitions which the generator marked pure the attributes of their effects, now that they
+    // don't count their calls. one which calls a function other than those may reach first-tier code, so keeps its mark
+    static void apply_marked_effects(llvm::Module& m)
+    {
+      std::unordered_set<const llvm::Function*> pure;
+      for(llvm::Function& f : m)
+      {
+        if(!f.isDeclaration() and f.hasFnAttribute(pure_attribute_name))
+        {
+          pure.insert(&f);
+        }
+      }
+
+      auto calls_only_pure = [&](const llvm::Function& f)
+      {
+        for(const llvm::BasicBlock& block : f)
+        {
+          for(const llvm::Instruction& instruction : block)
+          {
+            if(const llvm::CallInst* call = llvm::dyn_cast<llvm::CallInst>(&instruction))
+            {
+              const llvm::Function* callee = call->getCalledFunction();
+              if(!callee or (!pure.count(callee) and !callee->doesNotAccessMemory()))
+              {
+                return false;
+              }
+            }
+          }
+        }
+
+        return true;
+      };
+
+      // forgetting one function may leave its callers calling impure code, so repeat until none are forgotten
+      bool forgot = true;
+      while(forgot)
+      {
+        forgot = false;
+        for(auto f = pure.begin(); f != pure.end();)
+        {
+          if(calls_only_pure(**f))
+          {
+            ++f;
+          }
+          else
+          {
+            f = pure.erase(f);
+            forgot = true;
+          }
+        }
+      }
+
+      for(llvm::Function& f : m)
+      {
+        if(pure.count(&f))
+        {
+          f.setDoesNotAccessMemory();
+          f.setDoesNotThrow();
+
+          if(f.hasFnAttribute(terminates_attribute_name))
+          {
+            f.addFnAttr(llvm::Attribute::Speculatable);
+          }
+        }
+      }
+    }
+
+    target_context* target_;
+    object_layer_t object_layer_;
 
     compile_layer_t compile_layer_;
-    std::vector<module_handle_t> module_handles_;
-};
 
+    // handles are issued in increasing order, so this is also the order the modules were added in
+    std::map<module_handle_t, loaded_module> modules_;
+    module_handle_t next_module_handle_ = 0;
+
+    // guards the layers, the modules, and the stubs, which the interpreter and the tier-up thread share
+    // linking calls back into our resolver, so the lock must be reentrant
+    std::recursive_mutex mutex_;
+
+    // the stubs through which lazy and tiered functions are called, indexed by mangled name
+    std::unique_ptr<llvm::orc::IndirectStubsManager> stubs_;
+    std::unordered_map<std::string, stubbed_function> stubbed_functions_;
+
+    // the callers whose recompiled code linked in each function, by mangled name
+    // entries may be stale, since they're only removed when the function is redefined
+    std::unordered_map<std::string, std::unordered_set<std::string>> relinking_callers_;
+    std::unique_ptr<llvm::orc::JITCompileCallbackManager> compile_callbacks_;
+    std::string tier_up_function_symbol_;
+    std::string tier_up_context_symbol_;
+    std::string memo_table_function_symbol_;
+    std::string memo_find_function_symbol_;
+    std::string memo_insert_function_symbol_;
+
+    // the tables of memoized functions, by name and number of parameters, which generated code reads and writes without the lock
+    mutable std::mutex memo_mutex_;
+    std::map<std::pair<std::string, std::uint64_t>, std::unique_ptr<memo_table>> memo_tables_;
+
+    std::unique_ptr<target_context> final_target_;
+
+    // guards the queue of hot functions and the statistics
+    mutable std::mutex tier_up_mutex_;
+    std::condition_variable tier_up_requested_;
+    std::deque<std::string> tier_up_requests_;
+    bool stopping_ = false;
+    jit_statistics statistics_;
+
+    // declared last, so it's started after everything it uses
+    std::thread tier_up_thread_;
+};
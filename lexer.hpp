@@ -1,8 +1,17 @@
 #pragma once
 
+#include <charconv>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <iostream>
+#include <type_traits>
+#include "recursive_variant.hpp"
+#include "scan.hpp"
+#include "source_buffer.hpp"
+#include "symbol.hpp"
 
 enum class keyword
 {
@@ -65,7 +74,109 @@ inline std::ostream& operator<<(std::ostream& os, const keyword& kw)
   return os;
 }
 
-using token = std::variant<keyword, std::string, double, char>;
+namespace detail
+{
+
+
+struct keyword_spelling
+{
+  std::string_view spelling;
+  keyword kw;
+};
+
+
+constexpr keyword_spelling keyword_spellings[] = {
+  {"def",    keyword::def},
+  {"else",   keyword::else_},
+  {"extern", keyword::extern_},
+  {"for",    keyword::for_},
+  {"if",     keyword::if_},
+  {"in",     keyword::in},
+  {"then",   keyword::then}
+};
+
+
+constexpr std::size_t min_keyword_size = 2;
+constexpr std::size_t max_keyword_size = 6;
+constexpr std::size_t keyword_table_size = 16;
+
+
+// a perfect hash over the keywords' sizes and first and last characters
+constexpr std::size_t keyword_hash(std::string_view word)
+{
+  return (word.size() + 4 * word.front() + 3 * word.back()) % keyword_table_size;
+}
+
+
+struct keyword_table
+{
+  keyword_spelling slots[keyword_table_size];
+};
+
+
+constexpr keyword_table make_keyword_table()
+{
+  keyword_table result{};
+
+  for(const keyword_spelling& entry : keyword_spellings)
+  {
+    if(entry.spelling.size() < min_keyword_size or max_keyword_size < entry.spelling.size())
+    {
+      throw "keyword_spellings disagree with min_keyword_size or max_keyword_size";
+    }
+
+    keyword_spelling& slot = result.slots[keyword_hash(entry.spelling)];
+
+    // a collision means keyword_hash is no longer perfect
+    if(!slot.spelling.empty())
+    {
+      throw "keyword_hash collision";
+    }
+
+    slot = entry;
+  }
+
+  return result;
+}
+
+
+// evaluating this at compile time verifies that keyword_hash is perfect
+constexpr keyword_table keyword_lookup_table = make_keyword_table();
+
+
+} // end detail
+
+
+// returns the keyword spelled by word, if there is one
+constexpr std::optional<keyword> find_keyword(std::string_view word)
+{
+  if(word.size() < detail::min_keyword_size or detail::max_keyword_size < word.size())
+  {
+    return std::nullopt;
+  }
+
+  // the only keyword word could be is the one in its slot
+  const detail::keyword_spelling& slot = detail::keyword_lookup_table.slots[detail::keyword_hash(word)];
+
+  if(slot.spelling == word)
+  {
+    return slot.kw;
+  }
+
+  return std::nullopt;
+}
+
+
+static_assert(find_keyword("extern") == keyword::extern_);
+static_assert(!find_keyword("x"));
+static_assert(!find_keyword("fib"));
+
+
+// identifiers are interned, so tokens are small and trivially copyable
+using token = std::variant<keyword, symbol, double, char>;
+
+static_assert(sizeof(token) == 16, "token should be 16 bytes");
+static_assert(std::is_trivially_copyable_v<token>, "token should be trivially copyable");
 
 namespace std
 {
@@ -73,7 +184,7 @@ namespace std
 
 inline std::ostream& operator<<(std::ostream& os, const token& t)
 {
-  std::visit([&](const auto& t)
+  ::visit([&](const auto& t)
   {
     os << t;
   },
@@ -86,97 +197,159 @@ inline std::ostream& operator<<(std::ostream& os, const token& t)
 } // end namespace std
 
 
-inline token get_token()
+class lexer
 {
-  char last_char = ' ';
+  public:
+    explicit lexer(source_buffer source)
+      : source_(std::move(source)),
+        position_(source_.begin()),
+        end_(source_.end())
+    {}
 
-  // skip whitespace
-  while(isspace(last_char = getchar()))
-  {
-    ;
-  }
+    // moving a source_buffer may move its characters, so the position is re-seated by its offset
+    lexer(lexer&& other)
+      : lexer(std::move(other), other.position_ - other.source_.begin())
+    {}
 
-  // get an identifier or keyword
-  if(isalpha(last_char))
-  {
-    std::string word(1, last_char);
-    while(isalpha((last_char = getchar())))
+    lexer& operator=(lexer&& other)
     {
-      word += last_char;
+      std::ptrdiff_t offset = other.position_ - other.source_.begin();
+      source_ = std::move(other.source_);
+      position_ = source_.begin() + offset;
+      end_ = source_.end();
+      return *this;
     }
 
-    // put back the last char
-    ungetc(last_char, stdin);
-
-    if(word == "def")
-    {
-      return keyword::def;
-    }
-    else if(word == "else")
+    inline token next()
     {
-      return keyword::else_;
-    }
-    else if(word == "extern")
-    {
-      return keyword::extern_;
-    }
-    else if(word == "for")
-    {
-      return keyword::for_;
-    }
-    else if(word == "if")
-    {
-      return keyword::if_;
+      // skip whitespace and comments
+      while(true)
+      {
+        skip_spaces();
+
+        if(at_end())
+        {
+          return token(char(EOF));
+        }
+
+        if(*position_ != '#')
+        {
+          break;
+        }
+
+        // skip the comment through the end of its line
+        skip(find_line_end);
+      }
+
+      char last_char = *position_;
+
+      // get an identifier or keyword
+      if(is_alpha(last_char))
+      {
+        std::string_view word = scan_while(is_alpha);
+
+        if(std::optional<keyword> kw = find_keyword(word))
+        {
+          return *kw;
+        }
+
+        return intern(word);
+      }
+
+      // get a number
+      else if(is_digit(last_char) || last_char == '.')
+      {
+        std::string_view number = scan_while([](char c)
+        {
+          return is_digit(c) || c == '.';
+        });
+
+        // convert the string to a double
+        // the whole string must be consumed, so e.g. 1.2.3 is rejected
+        double value = 0;
+        auto [parsed_end, error] = std::from_chars(number.data(), number.data() + number.size(), value, std::chars_format::fixed);
+        if(error != std::errc() or parsed_end != number.data() + number.size())
+        {
+          throw std::runtime_error(std::string("Malformed number '") + std::string(number) + "'");
+        }
+
+        return value;
+      }
+
+      // just return the last character
+      ++position_;
+      return last_char;
     }
-    else if(word == "in")
+
+  private:
+    lexer(lexer&& other, std::ptrdiff_t offset)
+      : source_(std::move(other.source_)),
+        position_(source_.begin() + offset),
+        end_(source_.end())
+    {}
+
+    // reads the next chunk of a streamed source
+    // token_begin is rebased into the refilled buffer
+    // returns false if no more characters are available
+    inline bool refill(const char*& token_begin)
     {
-      return keyword::in;
+      std::size_t token_size = position_ - token_begin;
+      token_begin = source_.refill(token_begin);
+      position_ = token_begin + token_size;
+      end_ = source_.end();
+      return position_ != end_;
     }
-    else if(word == "then")
+
+    inline bool at_end()
     {
-      return keyword::then;
+      const char* ignored = position_;
+      return position_ == end_ and !refill(ignored);
     }
 
-    return word;
-  }
-
-  // get a number
-  else if(isdigit(last_char) || last_char == '.')
-  {
-    std::string number(1, last_char);
-    while(isdigit(last_char = getchar()) || last_char == '.')
+    // advances to the first character found by search, refilling as necessary
+    inline void skip(detail::search_function search)
     {
-      number += last_char;
+      do
+      {
+        position_ = search(position_, end_);
+      }
+      while(position_ == end_ and !at_end());
     }
 
-    // put back the last char
-    ungetc(last_char, stdin);
-
-    // convert the string to a double
-    return strtod(number.c_str(), 0);
-  }
-
-  // skip comments
-  else if(last_char == '#')
-  {
-    while((last_char = getchar()) != EOF and last_char != '\n' and last_char != '\r')
+    inline void skip_spaces()
     {
-      ;
+      // tokens are usually separated by a single space, which isn't worth a vector search
+      if(position_ != end_ and is_space(*position_))
+      {
+        ++position_;
+      }
+
+      if(position_ == end_ or is_space(*position_))
+      {
+        skip(find_non_space);
+      }
     }
 
-    if(last_char != EOF)
+    // returns the run of characters beginning at the current position which satisfy pred
+    template<class Predicate>
+    inline std::string_view scan_while(Predicate pred)
     {
-      return get_token();
+      const char* token_begin = position_;
+
+      do
+      {
+        while(position_ != end_ and pred(*position_))
+        {
+          ++position_;
+        }
+      }
+      while(position_ == end_ and refill(token_begin));
+
+      return std::string_view(token_begin, position_ - token_begin);
     }
-  }
 
-  // check for EOF
-  else if(last_char == EOF)
-  {
-    return token(char(EOF));
-  }
-  
-  // just return the last character
-  return last_char;
-}
+    source_buffer source_;
+    const char* position_;
+    const char* end_;
+};
 
@@ -1,5 +1,6 @@
 // clang -std=c++17 main.cpp -lstdc++ -rdynamic `llvm-config --cppflags --ldflags --system-libs --libs core`
 #include <iostream>
+#include <string>
 #include "interpret.hpp"
 
 extern "C" double putchard(double x)
@@ -14,7 +15,7 @@ extern "C" double printd(double x)
   return 0;
 }
 
-int main()
+int main(int argc, char** argv)
 {
   // XXX what's the best place for this?
   llvm::InitializeNativeTarget();
@@ -25,7 +26,41 @@ int main()
   // XXX what's this for, and why don't we need it?
   //InitializeNativeTargetAsmParser();
 
-  interpret();
+  if(argc > 2 and std::string(argv[1]) == "--whole-program")
+  {
+    // compile the file as one module, so that its functions may be inlined into one another
+    // a file which defines a function more than once is rejected, since a module can only hold one
+    // definition of each; such files may be run without --whole-program, which reads them in order
+    try
+    {
+      source_buffer source = source_buffer::from_file(argv[2]);
+      interpret_whole_program(parse_program_in_parallel(std::string_view(source.begin(), source.end() - source.begin()),
+                                                        std::thread::hardware_concurrency(),
+                                                        parser_options::quiet()));
+    }
+    catch(const std::exception& e)
+    {
+      std::cerr << "--whole-program: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+  else if(argc > 1)
+  {
+    // the whole file is available up front, so parse it in parallel before interpreting it
+    // files are often generated, and generated code tends to repeat itself, so share equal subexpressions
+    parser_options options = parser_options::quiet();
+    options.share_subexpressions = true;
+
+    source_buffer source = source_buffer::from_file(argv[1]);
+    interpret(parse_program_in_parallel(std::string_view(source.begin(), source.end() - source.begin()),
+                                        std::thread::hardware_concurrency(),
+                                        options));
+  }
+  else
+  {
+    // interpret stdin as it arrives
+    interpret(source_buffer::from_stream());
+  }
 
   return 0;
 }
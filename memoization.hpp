@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// memoized functions call the generator's wrapper first, which looks their arguments up
+// in a memo_table, and only calls the function itself when its result isn't there
+//
+// the wrapper gets its function's table by calling memo_table_function_name with the
+// address of tier_up_context_name, the function's name, and its number of parameters,
+// then calls memo_find_function_name and memo_insert_function_name with the table.
+// the jit_compiler resolves those symbols to itself and to its callbacks
+constexpr const char* memo_table_function_name = "__kaleidoscope_memo_table";
+constexpr const char* memo_find_function_name = "__kaleidoscope_memo_find";
+constexpr const char* memo_insert_function_name = "__kaleidoscope_memo_insert";
+
+// each memoized function caches its table's address in an internal global named after it, with this suffix
+constexpr const char* memo_table_suffix = ".memo";
+
+
+// what a full memo_table does with a new result
+enum class memo_eviction
+{
+  // replaces the entry which was used least recently
+  least_recently_used,
+
+  // keeps the entries it has, and forgets the new result
+  none
+};
+
+
+// a memo_table caches a function's results, keyed on the bit patterns of its arguments,
+// so that -0.0 and 0.0 are different keys, and a NaN argument is found again
+//
+// the table is split into sets of a few entries, and each key may only be stored in
+// the set its hash selects, so a set may be full while the table is not
+//
+// only the thread running generated code uses a table, but the counters may be read from any thread
+class memo_table
+{
+  public:
+    static constexpr std::size_t entries_per_set = 4;
+
+    // capacity is rounded up to a power of two, of at least entries_per_set entries
+    memo_table(std::size_t num_parameters, std::size_t capacity, memo_eviction eviction)
+      : num_parameters_(num_parameters),
+        num_sets_(round_up_to_power_of_two(std::max<std::size_t>(capacity, entries_per_set)) / entries_per_set),
+        eviction_(eviction),
+        keys_(num_sets_ * entries_per_set * num_parameters_),
+        values_(num_sets_ * entries_per_set),
+        last_used_(num_sets_ * entries_per_set),
+        hits_(0),
+        misses_(0),
+        evictions_(0)
+    {}
+
+    std::size_t capacity() const
+    {
+      return values_.size();
+    }
+
+    // returns whether arguments' result is cached, and if it is, stores it into result
+    bool find(const double* arguments, double& result)
+    {
+      std::size_t first = first_entry(arguments);
+
+      for(std::size_t entry = first; entry < first + entries_per_set; ++entry)
+      {
+        if(last_used_[entry] != 0 and std::memcmp(&keys_[entry * num_parameters_], arguments, num_parameters_ * sizeof(double)) == 0)
+        {
+          last_used_[entry] = ++clock_;
+          result = values_[entry];
+          increment(hits_);
+          return true;
+        }
+      }
+
+      increment(misses_);
+      return false;
+    }
+
+    // caches arguments' result, which find() didn't find
+    void insert(const double* arguments, double result)
+    {
+      std::size_t first = first_entry(arguments);
+
+      // use an empty entry, or the least recently used one
+      std::size_t victim = first;
+      for(std::size_t entry = first; entry < first + entries_per_set; ++entry)
+      {
+        if(last_used_[entry] < last_used_[victim])
+        {
+          victim = entry;
+        }
+      }
+
+      if(last_used_[victim] != 0)
+      {
+        if(eviction_ == memo_eviction::none)
+        {
+          return;
+        }
+
+        increment(evictions_);
+      }
+
+      std::memcpy(&keys_[victim * num_parameters_], arguments, num_parameters_ * sizeof(double));
+      values_[victim] = result;
+      last_used_[victim] = ++clock_;
+    }
+
+    // forgets every result, which is necessary when the function, or a function it calls, is redefined
+    void clear()
+    {
+      std::fill(last_used_.begin(), last_used_.end(), 0);
+    }
+
+    std::uint64_t hits() const
+    {
+      return hits_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t misses() const
+    {
+      return misses_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t evictions() const
+    {
+      return evictions_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static std::size_t round_up_to_power_of_two(std::size_t n)
+    {
+      std::size_t result = 1;
+      while(result < n)
+      {
+        result *= 2;
+      }
+
+      return result;
+    }
+
+    // there's only one writer, so the counters needn't be incremented atomically
+    static void increment(std::atomic<std::uint64_t>& counter)
+    {
+      counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::size_t first_entry(const double* arguments) const
+    {
+      std::uint64_t hash = num_parameters_;
+      for(std::size_t i = 0; i < num_parameters_; ++i)
+      {
+        std::uint64_t bits;
+        std::memcpy(&bits, &arguments[i], sizeof(bits));
+
+        hash = (hash ^ bits) * 0x9e3779b97f4a7c15;
+        hash ^= hash >> 32;
+      }
+
+      return (hash & (num_sets_ - 1)) * entries_per_set;
+    }
+
+    std::size_t num_parameters_;
+    std::size_t num_sets_;
+    memo_eviction eviction_;
+
+    // each entry's arguments, result, and the time it was last used, or 0 when it's empty
+    std::vector<double> keys_;
+    std::vector<double> values_;
+    std::vector<std::uint64_t> last_used_;
+    std::uint64_t clock_ = 0;
+
+    std::atomic<std::uint64_t> hits_;
+    std::atomic<std::uint64_t> misses_;
+    std::atomic<std::uint64_t> evictions_;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include "target.hpp"
+
+// an optimizer runs the target's optimization pipelines with LLVM's new pass manager
+//
+// the function pipeline runs on each function as soon as it is generated, and the
+// module pipeline runs on each module as it is released to the jit_compiler, which
+// is where interprocedural passes, like inlining, get to see several functions
+//
+// the default module pipeline simplifies each function itself, so by default the
+// function pipeline is empty, and only a textual function pipeline runs early
+class optimizer
+{
+  public:
+    explicit optimizer(target_context& target)
+      : pass_builder_(&target.target_machine())
+    {
+      // let the analyses find each other
+      pass_builder_.registerModuleAnalyses(module_analyses_);
+      pass_builder_.registerCGSCCAnalyses(cgscc_analyses_);
+      pass_builder_.registerFunctionAnalyses(function_analyses_);
+      pass_builder_.registerLoopAnalyses(loop_analyses_);
+      pass_builder_.crossRegisterProxies(loop_analyses_, function_analyses_, cgscc_analyses_, module_analyses_);
+
+      const codegen_options& options = target.options();
+
+      // the first tier is compiled without optimization; hot functions are optimized when they're recompiled
+      if(options.tiered)
+      {
+        return;
+      }
+
+      if(!options.function_passes.empty())
+      {
+        parse(function_passes_, options.function_passes);
+      }
+
+      if(!options.module_passes.empty())
+      {
+        parse(module_passes_, options.module_passes);
+
+        // a textual module pipeline may not simplify functions, so they're simplified as they're generated
+        if(options.function_passes.empty() and options.optimization != optimization_level::O0)
+        {
+          function_passes_ = pass_builder_.buildFunctionSimplificationPipeline(pass_builder_level(options.optimization), llvm::PassBuilder::ThinLTOPhase::None);
+        }
+      }
+      else if(options.optimization != optimization_level::O0)
+      {
+        module_passes_ = pass_builder_.buildPerModuleDefaultPipeline(pass_builder_level(options.optimization));
+      }
+    }
+
+    optimizer(const optimizer&) = delete;
+    optimizer& operator=(const optimizer&) = delete;
+
+    void optimize(llvm::Function& f)
+    {
+      function_passes_.run(f, function_analyses_);
+    }
+
+    // optimizes a module which is about to leave the generator
+    // the analyses of its functions are forgotten, since they won't be seen again
+    void optimize(llvm::Module& m)
+    {
+      module_passes_.run(m, module_analyses_);
+      forget_analyses();
+    }
+
+    // forgets every cached analysis, which must be done before the functions they describe are destroyed
+    void forget_analyses()
+    {
+      loop_analyses_.clear();
+      function_analyses_.clear();
+      cgscc_analyses_.clear();
+      module_analyses_.clear();
+    }
+
+  private:
+    static llvm::PassBuilder::OptimizationLevel pass_builder_level(optimization_level level)
+    {
+      switch(level)
+      {
+        case optimization_level::O0: return llvm::PassBuilder::O0;
+        case optimization_level::O1: return llvm::PassBuilder::O1;
+        case optimization_level::O2: return llvm::PassBuilder::O2;
+        default:                     return llvm::PassBuilder::O3;
+      }
+    }
+
+    template<class PassManager>
+    void parse(PassManager& passes, const std::string& pipeline)
+    {
+      if(!pass_builder_.parsePassPipeline(passes, pipeline))
+      {
+        throw std::runtime_error(std::string("Could not parse pass pipeline '") + pipeline + "'");
+      }
+    }
+
+    llvm::PassBuilder pass_builder_;
+
+    // outer analysis managers hold proxies which clear the inner ones when they're destroyed,
+    // so inner managers are declared first, to be destroyed last
+    llvm::LoopAnalysisManager loop_analyses_;
+    llvm::FunctionAnalysisManager function_analyses_;
+    llvm::CGSCCAnalysisManager cgscc_analyses_;
+    llvm::ModuleAnalysisManager module_analyses_;
+
+    llvm::FunctionPassManager function_passes_;
+    llvm::ModulePassManager module_passes_;
+};
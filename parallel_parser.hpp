@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "parser.hpp"
+#include "statement_boundaries.hpp"
+
+// parses a large program on several threads at once
+//
+// the text is cut into chunks at statement boundaries and each chunk is parsed
+// by its own parser into its own arena. symbols are interned in the global
+// symbol_table, which is safe to share, and the chunks' statements are joined
+// in source order
+
+
+// parses text on num_threads threads
+// the result is the same as parser(source_buffer::from_view(text), options).parse_program()
+inline program parse_program_in_parallel(std::string_view text,
+                                         std::size_t num_threads = std::thread::hardware_concurrency(),
+                                         parser_options options = parser_options::quiet())
+{
+  num_threads = std::max<std::size_t>(num_threads, 1);
+
+  // cut the text into several chunks per thread to even out the differences
+  // in how long chunks take to parse, but don't make chunks so small that
+  // the cost of starting them dominates
+  const std::size_t min_chunk_size = 16 << 10;
+  std::size_t max_num_chunks = std::min(4 * num_threads, text.size() / min_chunk_size + 1);
+  std::vector<std::string_view> chunks = split_at_statement_boundaries(text, max_num_chunks);
+
+  std::vector<std::optional<program>> parsed_chunks(chunks.size());
+  std::vector<std::exception_ptr> errors(chunks.size());
+  std::atomic<std::size_t> next_chunk(0);
+
+  auto parse_chunks = [&]
+  {
+    for(std::size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+    {
+      try
+      {
+        parser p(source_buffer::from_view(chunks[i]), options);
+        parsed_chunks[i] = p.parse_program();
+      }
+      catch(...)
+      {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+
+  // this thread parses too
+  std::vector<std::thread> workers;
+  for(std::size_t i = 1; i < std::min(num_threads, chunks.size()); ++i)
+  {
+    workers.emplace_back(parse_chunks);
+  }
+
+  parse_chunks();
+
+  for(std::thread& worker : workers)
+  {
+    worker.join();
+  }
+
+  // join the chunks in source order, reporting the earliest error
+  program result({}, std::make_unique<arena>());
+  for(std::size_t i = 0; i < chunks.size(); ++i)
+  {
+    if(errors[i])
+    {
+      std::rethrow_exception(errors[i]);
+    }
+
+    result.append(std::move(*parsed_chunks[i]));
+  }
+
+  return result;
+}
+
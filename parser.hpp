@@ -2,18 +2,74 @@
 
 #include <vector>
 #include <cassert>
-#include <map>
+#include <memory>
+#include "binary_operators.hpp"
+#include "hash_consing.hpp"
 #include "syntax.hpp"
 #include "lexer.hpp"
 #include "overloaded.hpp"
 
+struct parser_options
+{
+  // report each top-level statement parsed to std::cout
+  bool verbose = true;
+
+  // share structurally equal subexpressions among the nodes in each arena
+  bool share_subexpressions = false;
+
+  static parser_options quiet()
+  {
+    parser_options result;
+    result.verbose = false;
+    return result;
+  }
+};
+
+
 class parser
 {
   public:
-    parser()
-      : current_token_(get_token()) // get the first token
+    explicit parser(source_buffer source, parser_options options = parser_options())
+      : lexer_(std::move(source)),
+        current_token_(lexer_.next()), // get the first token
+        arena_(std::make_unique<arena>()),
+        options_(options)
     {}
 
+    // returns the arena holding the nodes parsed so far
+    // subsequent nodes are allocated in a new arena
+    std::unique_ptr<arena> release_arena()
+    {
+      // nodes in the old arena can't be shared with the new one's
+      node_factory_.clear();
+
+      std::unique_ptr<arena> result = std::make_unique<arena>();
+      std::swap(result, arena_);
+      return result;
+    }
+
+    // destroys the nodes parsed so far, which nothing may refer to anymore, and reuses their memory for the next ones
+    // a loop which handles one statement at a time allocates nothing for nodes once the first block is big enough
+    void reset_arena()
+    {
+      // the destroyed nodes can't be shared with the next ones
+      node_factory_.clear();
+
+      arena_->reset();
+    }
+
+    // the arena holding the nodes parsed so far
+    const arena& node_arena() const
+    {
+      return *arena_;
+    }
+
+    // the factory which shares subexpressions, when options().share_subexpressions is set
+    const node_factory& nodes() const
+    {
+      return node_factory_;
+    }
+
     // XXX this really shouldn't be exposed
     const token& current_token() const
     {
@@ -33,13 +89,15 @@ class parser
         expected, current_token_);
       }
 
-      current_token_ = get_token();
+      current_token_ = lexer_.next();
       return expected;
     }
 
     // program := { top_level_statement | ';' }*
     inline program parse_program()
     {
+      arena::scope allocate_nodes_in(*arena_);
+
       std::vector<top_level_statement> statements;
     
       while(current_token_ != token(char(EOF)))
@@ -56,35 +114,60 @@ class parser
         }
       }
     
-      return {statements};
+      return {std::move(statements), release_arena()};
     }
 
     // top_level_statement := function | extern | expression
     inline top_level_statement parse_top_level_statement()
     {
+      arena::scope allocate_nodes_in(*arena_);
+
+      std::size_t object_count = arena_->object_count();
+      std::size_t bytes_used = arena_->bytes_used();
+
+      auto report = [&](const char* what)
+      {
+        if(!options_.verbose) return;
+
+        std::cout << "parse_top_level_statement: parsed " << what
+                  << " (" << arena_->object_count() - object_count << " nodes, "
+                  << arena_->bytes_used() - bytes_used << " arena bytes)" << std::endl;
+      };
+
       if(current_token_ == token(keyword::def))
       {
         auto result = parse_function();
-        std::cout << "parse_top_level_statement: parsed function" << std::endl;
+        report("function");
         return result;
       }
       else if(current_token_ == token(keyword::extern_))
       {
         auto result = parse_extern();
-        std::cout << "parse_top_level_statement: parsed extern" << std::endl;
+        report("extern");
         return result;
       }
 
       auto result = parse_expression();
-      std::cout << "parse_top_level_statement: parsed expression" << std::endl;
+      report("expression");
       return result;
     }
 
   private:
-    inline std::string parse_identifier()
+    template<class Node>
+    expression make_node(Node&& node)
     {
-      std::string result = std::get<std::string>(current_token_);
-      current_token_ = get_token();
+      if(options_.share_subexpressions)
+      {
+        return node_factory_.make(std::move(node));
+      }
+
+      return std::move(node);
+    }
+
+    inline symbol parse_identifier()
+    {
+      symbol result = std::get<symbol>(current_token_);
+      current_token_ = lexer_.next();
       return result;
     }
 
@@ -92,7 +175,7 @@ class parser
     inline number parse_number()
     {
       double result = std::get<double>(current_token_);
-      current_token_ = get_token();
+      current_token_ = lexer_.next();
       return {result};
     }
 
@@ -143,7 +226,7 @@ class parser
     // identifier_expression := identifier | identifier '(' expression* ')'
     inline expression parse_identifier_expression()
     {
-      std::string identifier = parse_identifier();
+      symbol identifier = parse_identifier();
 
       // check for a function call
       if(current_token_ != token('('))
@@ -152,7 +235,7 @@ class parser
         return variable{identifier};
       }
 
-      return call{identifier, parse_function_call_arguments()};
+      return make_node(call{identifier, parse_function_call_arguments()});
     }
 
     // primary_expression := if_expression | for_expression | identifier_expression | number | parens_expression
@@ -170,7 +253,7 @@ class parser
 
           return parse_for_expression();
         },
-        [this](const std::string&)
+        [this](const symbol&)
         {
           return parse_identifier_expression();
         },
@@ -186,81 +269,113 @@ class parser
       );
     }
 
-    inline int current_token_precedence()
+    inline const binary_operator_info& current_binary_operator() const
     {
-      static std::map<char, int> precedence;
-      if(precedence.empty())
-      {
-        precedence['<'] = 10;
-        precedence['+'] = 20;
-        precedence['-'] = 20;
-        precedence['*'] = 40;
-      }
+      static constexpr binary_operator_info not_an_operator{-1, associativity::left};
 
-      return visit(overloaded(
-        [&,this](char token)
-        {
-          auto found = precedence.find(token);
-          return found == precedence.end() ? -1 : found->second; 
-        },
-        [](const auto&)
-        {
-          return -1;
-        }),
-        current_token_
-      );
+      const char* c = std::get_if<char>(&current_token_);
+      return c ? binary_operators[*c] : not_an_operator;
     }
 
-    // binop_rhs := ('+' primary_expression)*
-    inline expression parse_binop_rhs(expression lhs, int precedence)
+    // expression := primary_expression (binary_operator primary_expression)*
+    //
+    // pending operands and operators, including open parentheses, are kept on
+    // explicit stacks rather than the native stack, so machine-generated
+    // expressions may be arbitrarily long or deeply parenthesized
+    inline expression parse_expression()
     {
+      std::vector<expression> operands;
+
+      // '(' marks an open parenthesis
+      std::vector<char> operators;
+      std::size_t num_open_parens = 0;
+
+      // combines the top two operands with the top operator
+      auto reduce = [&]
+      {
+        expression rhs = std::move(operands.back());
+        operands.pop_back();
+
+        expression lhs = std::move(operands.back());
+        operands.pop_back();
+
+        operands.push_back(make_node(binary_operation(operators.back(), std::move(lhs), std::move(rhs))));
+        operators.pop_back();
+      };
+
+      // reduces pending operators back to the innermost open parenthesis while pred holds
+      auto reduce_while = [&](auto pred)
+      {
+        while(!operators.empty() and operators.back() != '(' and pred(binary_operators[operators.back()]))
+        {
+          reduce();
+        }
+      };
+
+      auto always = [](const binary_operator_info&)
+      {
+        return true;
+      };
+
       while(true)
       {
-        // if this is a binary operation, find its precedence
-        int token_precedence = current_token_precedence();
-        if(token_precedence < precedence)
+        // open parenthesized subexpressions
+        while(current_token_ == token('('))
         {
-          break;
+          operators.push_back('(');
+          ++num_open_parens;
+          current_token_ = lexer_.next();
         }
 
-        // get the operator
-        char op = std::get<char>(current_token_);
-        current_token_ = get_token();
+        operands.push_back(parse_primary_expression());
 
-        // parse the expression beyond the operator
-        expression rhs = parse_primary_expression();
+        // close parenthesized subexpressions
+        // a ')' without a matching '(' belongs to our caller
+        while(num_open_parens > 0 and current_token_ == token(')'))
+        {
+          reduce_while(always);
+          operators.pop_back();
+          --num_open_parens;
+          current_token_ = lexer_.next();
+        }
 
-        // if the operator binds less tightly with rhs than the operator beyond rhs,
-        // let the pending operator take rhs as its lhs
-        int next_precedence = current_token_precedence();
-        if(token_precedence < next_precedence)
+        const binary_operator_info& op_info = current_binary_operator();
+        if(!op_info.is_binary_operator())
         {
-          rhs = parse_binop_rhs(std::move(rhs), token_precedence + 1);
+          break;
         }
 
-        // merge lhs & rhs
-        lhs = binary_operation(op, std::move(lhs), std::move(rhs));
+        // the pending operators which bind at least as tightly as this one take the operand to their right
+        reduce_while([&](const binary_operator_info& pending)
+        {
+          return op_info.precedence < pending.precedence or
+                 (op_info.precedence == pending.precedence and op_info.assoc == associativity::left);
+        });
+
+        operators.push_back(std::get<char>(current_token_));
+        current_token_ = lexer_.next();
       }
 
-      return lhs;
-    }
+      if(num_open_parens > 0)
+      {
+        // report the missing ')'
+        parse_token(')');
+      }
 
-    // expression := primary_expression binop_rhs
-    inline expression parse_expression()
-    {
-      expression left_hand_expression = parse_primary_expression();
-      return parse_binop_rhs(left_hand_expression, 0);
+      reduce_while(always);
+
+      return std::move(operands.back());
     }
 
     // function_prototype := identifier '(' identifier* ')'
     inline function_prototype parse_function_prototype()
     {
-      std::string function_name = parse_identifier();
+      symbol function_name = parse_identifier();
 
       // consume '('
       parse_token('(');
 
-      std::vector<std::string> parameter_names;
+      std::vector<symbol> parameter_names;
 
       // parse parameters until we encounter ')'
       // XXX should introduce a parse_delimited_list() or some such
@@ -272,14 +387,14 @@ class parser
       // consume ')'
       parse_token(')');
 
-      return {function_name, parameter_names};
+      return {function_name, std::move(parameter_names)};
     }
 
     // function := 'def' prototype expression
     inline function parse_function()
     {
       assert(current_token_ == token(keyword::def));
-      current_token_ = get_token();
+      current_token_ = lexer_.next();
       return {parse_function_prototype(), parse_expression()};
     }
 
@@ -288,7 +403,7 @@ class parser
     {
       assert(current_token_ == token(keyword::extern_));
 
-      current_token_ = get_token();
+      current_token_ = lexer_.next();
 
       return parse_function_prototype();
     }
@@ -308,7 +423,7 @@ class parser
 
       expression else_branch = parse_expression();
 
-      return if_expression{condition, then_branch, else_branch};
+      return make_node(if_expression{std::move(condition), std::move(then_branch), std::move(else_branch)});
     }
 
     // for := 'for' identifier '=' expression ',' expression (',' expression)? 'in' expression
@@ -316,7 +431,7 @@ class parser
     {
       parse_token(keyword::for_);
 
-      std::string loop_variable_name = parse_identifier();
+      symbol loop_variable_name = parse_identifier();
 
       parse_token('=');
 
@@ -338,9 +453,13 @@ class parser
 
       expression body = parse_expression();
 
-      return for_expression{loop_variable_name, begin, end, step, body};
+      return make_node(for_expression{loop_variable_name, std::move(begin), std::move(end), std::move(step), std::move(body)});
     }
 
+    lexer lexer_;
     token current_token_;
+    std::unique_ptr<arena> arena_;
+    parser_options options_;
+    node_factory node_factory_;
 };
 
@@ -1,55 +1,63 @@
 #pragma once
 
+#include <algorithm>
 #include <variant>
 #include <memory>
+#include <stdexcept>
 #include <type_traits>
 #include <utility>
+#include "arena.hpp"
 
 namespace detail
 {
 
 
+// a wrapped<T> refers to a T allocated in the current thread's arena
+// the arena, not the wrapped<T>, owns the T, so wrapped<T>s are as cheap
+// to move and destroy as pointers. they may not be copied, so a T belongs
+// to one tree unless it is explicitly shared
 template<class T>
 class wrapped
 {
   public:
-    template<class... Args,
-             class = std::enable_if_t<
-               std::is_constructible_v<T,Args&&...>
-             >>
-    wrapped(Args&&... args)
-      : value_(std::make_unique<T>(std::forward<Args>(args)...))
-    {}
-
-    wrapped(const T& value)
-      : value_(std::make_unique<T>(value))
-    {}
-
     wrapped(T&& value)
-      : value_(std::make_unique<T>(std::move(value)))
+      : value_(make(std::move(value)))
     {}
 
-    wrapped(wrapped&&) = default;
+    // refers to an existing T, which is immutable and so may be shared by several trees
+    // the T must outlive this wrapped<T>
+    static wrapped share(const T& value)
+    {
+      return wrapped(&value);
+    }
 
-    wrapped(const wrapped& other)
-      : value_(std::make_unique<T>(other.value()))
-    {}
+    wrapped(wrapped&&) = default;
 
     wrapped& operator=(wrapped&&) = default;
-    wrapped& operator=(wrapped&) = default;
 
-    T& value()
+    const T& value() const
     {
       return *value_;
     }
 
-    const T& value() const
+  private:
+    explicit wrapped(const T* value)
+      : value_(value)
+    {}
+
+    template<class Arg>
+    static const T* make(Arg&& arg)
     {
-      return *value_;
+      arena* a = arena::current();
+      if(!a)
+      {
+        throw std::logic_error("wrapped: no arena is current");
+      }
+
+      return a->make<T>(std::forward<Arg>(arg));
     }
 
-  private:
-    std::unique_ptr<T> value_;
+    const T* value_;
 };
 
 
@@ -91,24 +99,13 @@ struct unwrap_and_call
     return std::forward<Arg>(arg);
   }
 
-  template<class Arg>
-  static Arg& unwrap_if(detail::wrapped<Arg>& arg)
-  {
-    return arg.value();
-  }
-
+  // wrapped values are immutable, so they are always forwarded as const
   template<class Arg>
   static const Arg& unwrap_if(const detail::wrapped<Arg>& arg)
   {
     return arg.value();
   }
 
-  template<class Arg>
-  static Arg&& unwrap_if(detail::wrapped<Arg>&& arg)
-  {
-    return std::move(arg.value());
-  }
-
   // forward unwrapped arguments to f
   template<class... Args>
   decltype(auto) operator()(Args&&... args) const
@@ -195,6 +192,141 @@ constexpr typename recursive_variant<Types...>::super_t&& super(recursive_varian
 }
 
 
+template<class T, class Variant>
+struct is_alternative;
+
+template<class T, class... Alternatives>
+struct is_alternative<T, std::variant<Alternatives...>>
+  : std::disjunction<std::is_same<T, Alternatives>...>
+{};
+
+
+} // end detail
+
+
+// returns a pointer to var's T, whether or not it is wrapped, or nullptr if var doesn't hold a T
+template<class T, class... Types>
+constexpr const T* get_if(const recursive_variant<Types...>* var)
+{
+  using super_t = typename recursive_variant<Types...>::super_t;
+
+  if constexpr(detail::is_alternative<detail::wrapped<T>, super_t>::value)
+  {
+    const detail::wrapped<T>* result = std::get_if<detail::wrapped<T>>(static_cast<const super_t*>(var));
+    return result ? &result->value() : nullptr;
+  }
+  else
+  {
+    return std::get_if<T>(static_cast<const super_t*>(var));
+  }
+}
+
+
+namespace detail
+{
+
+
+// variants with more alternatives than this are visited with std::visit
+constexpr std::size_t max_switch_alternatives = 16;
+
+// the number of leading alternatives which are tested for before the switch
+constexpr std::size_t num_likely_alternatives = 3;
+
+
+template<std::size_t I, class Visitor, class Variant>
+constexpr decltype(auto) visit_alternative(Visitor& visitor, Variant&& var)
+{
+  // the index has already been checked, so skip std::get's check
+  using alternative_reference = decltype(std::get<I>(std::forward<Variant>(var)));
+  return visitor(static_cast<alternative_reference>(*std::get_if<I>(&var)));
+}
+
+
+template<std::size_t I, class Visitor, class Variant>
+constexpr decltype(auto) visit_likely_alternative(Visitor& visitor, Variant&& var, std::size_t index)
+{
+  constexpr std::size_t num_alternatives = std::variant_size_v<std::remove_cv_t<std::remove_reference_t<Variant>>>;
+
+  if constexpr(I + 1 < std::min(num_alternatives, num_likely_alternatives))
+  {
+    if(index == I)
+    {
+      return visit_alternative<I>(visitor, std::forward<Variant>(var));
+    }
+
+    return visit_likely_alternative<I + 1>(visitor, std::forward<Variant>(var), index);
+  }
+  else
+  {
+    return visit_alternative<I>(visitor, std::forward<Variant>(var));
+  }
+}
+
+
+#define KALEIDOSCOPE_VISIT_CASE(i) \
+  case i: \
+  { \
+    if constexpr(i < num_alternatives) \
+    { \
+      return visit_alternative<i>(visitor, std::forward<Variant>(var)); \
+    } \
+    break; \
+  }
+
+
+// visits var's alternative with a switch over its index, rather than through std::visit's
+// table of function pointers, so that each case may be inlined into the visit
+//
+// the first few alternatives are tested for with predictable branches before
+// the switch's indirect jump, so variants should list their most common
+// alternatives first
+template<class Visitor, class Variant>
+constexpr decltype(auto) switch_visit(Visitor& visitor, Variant&& var)
+{
+  constexpr std::size_t num_alternatives = std::variant_size_v<std::remove_cv_t<std::remove_reference_t<Variant>>>;
+
+  if constexpr(num_alternatives > max_switch_alternatives)
+  {
+    return std::visit(visitor, std::forward<Variant>(var));
+  }
+  else
+  {
+    std::size_t index = var.index();
+
+    if(__builtin_expect(index < num_likely_alternatives, true))
+    {
+      return visit_likely_alternative<0>(visitor, std::forward<Variant>(var), index);
+    }
+
+    switch(index)
+    {
+      KALEIDOSCOPE_VISIT_CASE(0)
+      KALEIDOSCOPE_VISIT_CASE(1)
+      KALEIDOSCOPE_VISIT_CASE(2)
+      KALEIDOSCOPE_VISIT_CASE(3)
+      KALEIDOSCOPE_VISIT_CASE(4)
+      KALEIDOSCOPE_VISIT_CASE(5)
+      KALEIDOSCOPE_VISIT_CASE(6)
+      KALEIDOSCOPE_VISIT_CASE(7)
+      KALEIDOSCOPE_VISIT_CASE(8)
+      KALEIDOSCOPE_VISIT_CASE(9)
+      KALEIDOSCOPE_VISIT_CASE(10)
+      KALEIDOSCOPE_VISIT_CASE(11)
+      KALEIDOSCOPE_VISIT_CASE(12)
+      KALEIDOSCOPE_VISIT_CASE(13)
+      KALEIDOSCOPE_VISIT_CASE(14)
+      KALEIDOSCOPE_VISIT_CASE(15)
+    }
+
+    // var is valueless_by_exception
+    throw std::bad_variant_access();
+  }
+}
+
+
+#undef KALEIDOSCOPE_VISIT_CASE
+
+
 } // end detail
 
 
@@ -204,8 +336,15 @@ constexpr decltype(auto) visit(Visitor&& visitor, Variant&& var, Variants&&... v
   // unwrap wrapped types before the visitor sees them
   detail::unwrap_and_call<std::decay_t<Visitor>> unwrapping_visitor{std::forward<Visitor>(visitor)};
 
-  // unwrap recursive_variants into std::variant before passing to std::visit
-  return std::visit(std::move(unwrapping_visitor), detail::super(std::forward<Variant>(var)), detail::super(std::forward<Variants>(vars))...);
+  // unwrap recursive_variants into std::variant before dispatching
+  if constexpr(sizeof...(Variants) == 0)
+  {
+    return detail::switch_visit(unwrapping_visitor, detail::super(std::forward<Variant>(var)));
+  }
+  else
+  {
+    return std::visit(std::move(unwrapping_visitor), detail::super(std::forward<Variant>(var)), detail::super(std::forward<Variants>(vars))...);
+  }
 }
 
 
@@ -0,0 +1,223 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KALEIDOSCOPE_SCAN_X86 1
+#endif
+
+// vectorized searches used by the lexer to skip whitespace and comments
+//
+// each search examines 16 (SSE2) or 32 (AVX2) characters at a time. the widest
+// implementation the CPU supports is chosen the first time a search is made,
+// and every implementation finishes the last partial block with a scalar loop
+
+constexpr bool is_space(char c)
+{
+  // ' ', '\t', '\n', '\v', '\f', '\r'
+  return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+constexpr bool is_line_end(char c)
+{
+  return c == '\n' || c == '\r';
+}
+
+constexpr bool is_alpha(char c)
+{
+  return static_cast<unsigned char>((c | 0x20) - 'a') <= 'z' - 'a';
+}
+
+constexpr bool is_digit(char c)
+{
+  return static_cast<unsigned char>(c - '0') <= 9;
+}
+
+
+namespace detail
+{
+
+
+using search_function = const char*(*)(const char*, const char*);
+
+
+inline const char* find_non_space_scalar(const char* first, const char* last)
+{
+  while(first != last and is_space(*first))
+  {
+    ++first;
+  }
+
+  return first;
+}
+
+
+inline const char* find_line_end_scalar(const char* first, const char* last)
+{
+  while(first != last and !is_line_end(*first))
+  {
+    ++first;
+  }
+
+  return first;
+}
+
+
+#ifdef KALEIDOSCOPE_SCAN_X86
+
+__attribute__((target("sse2")))
+inline const char* find_non_space_sse2(const char* first, const char* last)
+{
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i control_range = _mm_set1_epi8('\r' - '\t');
+
+  for(; last - first >= 16; first += 16)
+  {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+
+    // c == ' ' or unsigned(c - '\t') <= '\r' - '\t'
+    __m128i offset = _mm_sub_epi8(block, tab);
+    __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(block, space),
+                                  _mm_cmpeq_epi8(_mm_min_epu8(offset, control_range), offset));
+
+    unsigned int non_spaces = ~_mm_movemask_epi8(spaces) & 0xFFFF;
+    if(non_spaces)
+    {
+      return first + __builtin_ctz(non_spaces);
+    }
+  }
+
+  return find_non_space_scalar(first, last);
+}
+
+
+__attribute__((target("sse2")))
+inline const char* find_line_end_sse2(const char* first, const char* last)
+{
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i carriage_return = _mm_set1_epi8('\r');
+
+  for(; last - first >= 16; first += 16)
+  {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+
+    __m128i line_ends = _mm_or_si128(_mm_cmpeq_epi8(block, newline),
+                                     _mm_cmpeq_epi8(block, carriage_return));
+
+    unsigned int mask = _mm_movemask_epi8(line_ends);
+    if(mask)
+    {
+      return first + __builtin_ctz(mask);
+    }
+  }
+
+  return find_line_end_scalar(first, last);
+}
+
+
+__attribute__((target("avx2")))
+inline const char* find_non_space_avx2(const char* first, const char* last)
+{
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i control_range = _mm256_set1_epi8('\r' - '\t');
+
+  for(; last - first >= 32; first += 32)
+  {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+
+    __m256i offset = _mm256_sub_epi8(block, tab);
+    __m256i spaces = _mm256_or_si256(_mm256_cmpeq_epi8(block, space),
+                                     _mm256_cmpeq_epi8(_mm256_min_epu8(offset, control_range), offset));
+
+    unsigned int non_spaces = ~static_cast<unsigned int>(_mm256_movemask_epi8(spaces));
+    if(non_spaces)
+    {
+      return first + __builtin_ctz(non_spaces);
+    }
+  }
+
+  return find_non_space_sse2(first, last);
+}
+
+
+__attribute__((target("avx2")))
+inline const char* find_line_end_avx2(const char* first, const char* last)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i carriage_return = _mm256_set1_epi8('\r');
+
+  for(; last - first >= 32; first += 32)
+  {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+
+    __m256i line_ends = _mm256_or_si256(_mm256_cmpeq_epi8(block, newline),
+                                        _mm256_cmpeq_epi8(block, carriage_return));
+
+    unsigned int mask = _mm256_movemask_epi8(line_ends);
+    if(mask)
+    {
+      return first + __builtin_ctz(mask);
+    }
+  }
+
+  return find_line_end_sse2(first, last);
+}
+
+#endif // KALEIDOSCOPE_SCAN_X86
+
+
+struct search_functions
+{
+  search_function find_non_space;
+  search_function find_line_end;
+};
+
+
+inline search_functions select_search_functions()
+{
+#ifdef KALEIDOSCOPE_SCAN_X86
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2"))
+  {
+    return {find_non_space_avx2, find_line_end_avx2};
+  }
+
+  if(__builtin_cpu_supports("sse2"))
+  {
+    return {find_non_space_sse2, find_line_end_sse2};
+  }
+#endif
+
+  return {find_non_space_scalar, find_line_end_scalar};
+}
+
+
+inline const search_functions& selected_search_functions()
+{
+  static const search_functions result = select_search_functions();
+  return result;
+}
+
+
+} // end detail
+
+
+// returns the first character in [first, last) which is not whitespace, or last
+inline const char* find_non_space(const char* first, const char* last)
+{
+  return detail::selected_search_functions().find_non_space(first, last);
+}
+
+
+// returns the first '\n' or '\r' in [first, last), or last
+inline const char* find_line_end(const char* first, const char* last)
+{
+  return detail::selected_search_functions().find_line_end(first, last);
+}
+
+
+// clean up after ourself
+#undef KALEIDOSCOPE_SCAN_X86
+
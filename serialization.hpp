@@ -0,0 +1,1110 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "source_buffer.hpp"
+#include "syntax.hpp"
+#include "overloaded.hpp"
+
+// a compact binary format for programs
+//
+// a serialized program is a header, a table of top-level statements, the
+// statements' records, a pool of numbers, and a table of the names they mention.
+// everything is referred to by offset from the beginning of the buffer or by
+// index, never by address, so a buffer may be memory-mapped anywhere and walked
+// in place, or converted into a program without lexing or parsing. records are
+// written children first, and subtrees which a node_factory shared are written
+// once and stay shared
+//
+// the buffer is a sequence of 32-bit words in the byte order of the machine
+// which wrote it. an expression is referred to by an operand, a word whose low
+// two bits say what the rest holds
+//
+//   00: the offset of the expression's record
+//   01: a variable, as the index of its name
+//   10: a number, as its index in the pool
+//   11: a number, as a 30-bit signed integer
+//
+// so leaves take no space of their own. the first word of a record holds its
+// kind in its low byte, and the layouts of the rest are
+//
+//   binary_operation:   (op in the second byte), lhs, rhs
+//   call:               callee, number of arguments, arguments...
+//   if_expression:      condition, then, else
+//   for_expression:     loop variable, begin, end, step (or 0 when absent), body
+//   function:           name, number of parameters, body, parameters...
+//   function_prototype: name, number of parameters, parameters...
+
+
+enum class record_kind : std::uint32_t
+{
+  number,
+  variable,
+  binary_operation,
+  call,
+  if_expression,
+  for_expression,
+  function,
+  function_prototype
+};
+
+
+namespace detail
+{
+
+
+struct serialized_header
+{
+  char magic[4];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint32_t size;
+  std::uint32_t num_statements;
+  std::uint32_t statements_offset;
+  std::uint32_t num_numbers;
+  std::uint32_t numbers_offset;
+  std::uint32_t num_names;
+  std::uint32_t names_offset;
+};
+
+constexpr char serialized_magic[4] = {'K', 'A', 'S', 'T'};
+constexpr std::uint32_t serialized_version = 1;
+constexpr std::uint32_t serialized_byte_order = 0x01020304;
+
+enum operand_tag : std::uint32_t
+{
+  record_operand,
+  variable_operand,
+  number_operand,
+  integer_operand
+};
+
+constexpr std::uint32_t operand_tag_mask = 3;
+
+// marks a record which more than one operand refers to
+constexpr std::uint32_t shared_record_flag = 1u << 31;
+
+
+class serializer
+{
+  public:
+    std::string operator()(const program& prog)
+    {
+      return write(prog.statements().size(), [&](std::uint32_t i)
+      {
+        return std::visit(overloaded(
+          [&](const function& f)
+          {
+            return write_function(f);
+          },
+          [&](const function_prototype& fp)
+          {
+            return write_prototype(record_kind::function_prototype, fp);
+          },
+          [&](const expression& e)
+          {
+            return write_expression(e);
+          }),
+          prog.statements()[i]
+        );
+      });
+    }
+
+    // writes a program of the single statement f
+    std::string operator()(const function& f)
+    {
+      return write(1, [&](std::uint32_t)
+      {
+        return write_function(f);
+      });
+    }
+
+  private:
+    // write_statement(i) writes the ith statement, and returns the offset of its record, or its operand
+    template<class WriteStatement>
+    std::string write(std::uint32_t num_statements, WriteStatement write_statement)
+    {
+      // reserve the header and the statement table, which we'll fill in as we go
+      buffer_.resize(sizeof(serialized_header));
+      std::uint32_t statements_offset = append_words(num_statements);
+
+      for(std::uint32_t i = 0; i < num_statements; ++i)
+      {
+        patch(statements_offset + 4 * i, write_statement(i));
+      }
+
+      // write the pool of numbers, which directly follows the records
+      std::uint32_t numbers_offset = buffer_.size();
+      buffer_.append(reinterpret_cast<const char*>(numbers_.data()), numbers_.size() * sizeof(double));
+
+      // write the name table
+      std::uint32_t names_offset = buffer_.size();
+      for(symbol name : names_)
+      {
+        const std::string& str = name.str();
+        append_word(str.size());
+        buffer_.append(str);
+        buffer_.resize((buffer_.size() + 3) & ~std::size_t(3));
+      }
+
+      if(buffer_.size() > UINT32_MAX)
+      {
+        throw std::runtime_error("Program too large to serialize");
+      }
+
+      serialized_header header;
+      std::memcpy(header.magic, serialized_magic, sizeof(header.magic));
+      header.version = serialized_version;
+      header.byte_order = serialized_byte_order;
+      header.size = buffer_.size();
+      header.num_statements = num_statements;
+      header.statements_offset = statements_offset;
+      header.num_numbers = numbers_.size();
+      header.numbers_offset = numbers_offset;
+      header.num_names = names_.size();
+      header.names_offset = names_offset;
+      std::memcpy(&buffer_[0], &header, sizeof(header));
+
+      return std::move(buffer_);
+    }
+
+    std::uint32_t write_function(const function& f)
+    {
+      std::uint32_t body = write_expression(f.body());
+      std::uint32_t result = write_prototype(record_kind::function, f.prototype());
+      patch(result + 12, body);
+      return result;
+    }
+
+    void append_word(std::uint32_t word)
+    {
+      buffer_.append(reinterpret_cast<const char*>(&word), sizeof(word));
+    }
+
+    // appends num_words zeroes, returning their offset
+    std::uint32_t append_words(std::size_t num_words)
+    {
+      std::uint32_t result = buffer_.size();
+      buffer_.resize(buffer_.size() + 4 * num_words);
+      return result;
+    }
+
+    // begins a record of the given kind and size, returning its offset
+    std::uint32_t begin_record(record_kind kind, std::size_t num_words)
+    {
+      std::uint32_t result = append_words(num_words);
+      patch(result, static_cast<std::uint32_t>(kind));
+      return result;
+    }
+
+    void patch(std::uint32_t offset, std::uint32_t word)
+    {
+      std::memcpy(&buffer_[offset], &word, sizeof(word));
+    }
+
+    std::uint32_t name_index(symbol name)
+    {
+      auto [position, inserted] = name_indices_.emplace(name, names_.size());
+      if(inserted)
+      {
+        names_.push_back(name);
+      }
+
+      return position->second;
+    }
+
+    std::uint32_t number_operand(double value)
+    {
+      // most numbers are small integers, which fit in the operand itself
+      if(value == std::trunc(value) and value >= -(1 << 29) and value < (1 << 29) and !(value == 0 and std::signbit(value)))
+      {
+        return (static_cast<std::uint32_t>(static_cast<std::int32_t>(value)) << 2) | integer_operand;
+      }
+
+      std::uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+
+      auto [position, inserted] = number_indices_.emplace(bits, numbers_.size());
+      if(inserted)
+      {
+        numbers_.push_back(value);
+      }
+
+      return (position->second << 2) | detail::number_operand;
+    }
+
+    std::uint32_t write_prototype(record_kind kind, const function_prototype& prototype)
+    {
+      const std::vector<symbol>& parameters = prototype.parameters();
+
+      // functions have an extra word for their body
+      std::size_t first_parameter = kind == record_kind::function ? 4 : 3;
+
+      std::uint32_t result = begin_record(kind, first_parameter + parameters.size());
+      patch(result + 4, name_index(prototype.name()));
+      patch(result + 8, parameters.size());
+      for(std::size_t i = 0; i < parameters.size(); ++i)
+      {
+        patch(result + 4 * (first_parameter + i), name_index(parameters[i]));
+      }
+
+      return result;
+    }
+
+    // writes e's records, returning the operand which refers to e
+    // records are written in postorder with an explicit stack, so deep expressions are safe to write
+    std::uint32_t write_expression(const expression& e)
+    {
+      struct pending
+      {
+        const expression* e;
+        bool children_done;
+      };
+
+      std::vector<pending> stack{{&e, false}};
+      std::vector<std::uint32_t> operands;
+
+      // pops the operands of a record's last num_children children into the record's words
+      auto pop_operands = [&](std::uint32_t record, std::size_t first_word, std::size_t num_children)
+      {
+        for(std::size_t i = num_children; i > 0; --i)
+        {
+          patch(record + 4 * (first_word + i - 1), operands.back());
+          operands.pop_back();
+        }
+      };
+
+      while(!stack.empty())
+      {
+        pending item = stack.back();
+        stack.pop_back();
+
+        // refer to shared records which were already written
+        const void* node = identity(*item.e);
+        if(node and !item.children_done)
+        {
+          auto found = written_.find(node);
+          if(found != written_.end())
+          {
+            std::uint32_t first_word = 0;
+            std::memcpy(&first_word, &buffer_[found->second], sizeof(first_word));
+            patch(found->second, first_word | shared_record_flag);
+            operands.push_back(found->second);
+            continue;
+          }
+        }
+
+        if(!node)
+        {
+          operands.push_back(::visit(overloaded(
+            [&](const number& n)
+            {
+              return number_operand(n.value());
+            },
+            [&](const variable& v)
+            {
+              return (name_index(v.name()) << 2) | variable_operand;
+            },
+            [](const auto&) -> std::uint32_t
+            {
+              // other nodes have records
+              return 0;
+            }),
+            *item.e
+          ));
+
+          continue;
+        }
+
+        if(!item.children_done)
+        {
+          // write the children first; they are popped in reverse, so push them in reverse
+          stack.push_back({item.e, true});
+          for_each_child(*item.e, [&](const expression& child)
+          {
+            stack.push_back({&child, false});
+          });
+
+          continue;
+        }
+
+        std::uint32_t record = ::visit(overloaded(
+          [&](const binary_operation& b)
+          {
+            std::uint32_t result = begin_record(record_kind::binary_operation, 3);
+            patch(result, static_cast<std::uint32_t>(record_kind::binary_operation) | (static_cast<unsigned char>(b.op()) << 8));
+            pop_operands(result, 1, 2);
+            return result;
+          },
+          [&](const call& c)
+          {
+            std::uint32_t result = begin_record(record_kind::call, 3 + c.arguments().size());
+            patch(result + 4, name_index(c.callee_name()));
+            patch(result + 8, c.arguments().size());
+            pop_operands(result, 3, c.arguments().size());
+            return result;
+          },
+          [&](const if_expression&)
+          {
+            std::uint32_t result = begin_record(record_kind::if_expression, 4);
+            pop_operands(result, 1, 3);
+            return result;
+          },
+          [&](const for_expression& f)
+          {
+            std::uint32_t result = begin_record(record_kind::for_expression, 6);
+            patch(result + 4, name_index(f.loop_variable_name()));
+            pop_operands(result, 5, 1);
+            if(f.step())
+            {
+              pop_operands(result, 4, 1);
+            }
+            pop_operands(result, 2, 2);
+            return result;
+          },
+          [](const auto&) -> std::uint32_t
+          {
+            // numbers and variables were written above
+            return 0;
+          }),
+          *item.e
+        );
+
+        operands.push_back(record);
+        written_.emplace(node, record);
+      }
+
+      return operands.back();
+    }
+
+    // calls f on each of e's children, in reverse
+    template<class Function>
+    static void for_each_child(const expression& e, Function f)
+    {
+      ::visit(overloaded(
+        [&](const binary_operation& b)
+        {
+          f(b.rhs());
+          f(b.lhs());
+        },
+        [&](const call& c)
+        {
+          for(auto argument = c.arguments().rbegin(); argument != c.arguments().rend(); ++argument)
+          {
+            f(*argument);
+          }
+        },
+        [&](const if_expression& i)
+        {
+          f(i.else_expression());
+          f(i.then_expression());
+          f(i.condition());
+        },
+        [&](const for_expression& fe)
+        {
+          f(fe.body());
+          if(fe.step())
+          {
+            f(*fe.step());
+          }
+          f(fe.end());
+          f(fe.begin());
+        },
+        [](const auto&)
+        {
+          // leaves have no children
+        }),
+        e
+      );
+    }
+
+    // the address of e's node if it has a record which may be shared, or nullptr
+    static const void* identity(const expression& e)
+    {
+      return ::visit(overloaded(
+        [](const number&) -> const void*
+        {
+          return nullptr;
+        },
+        [](const variable&) -> const void*
+        {
+          return nullptr;
+        },
+        [](const auto& node) -> const void*
+        {
+          return &node;
+        }),
+        e
+      );
+    }
+
+    std::string buffer_;
+    std::vector<symbol> names_;
+    std::unordered_map<symbol, std::uint32_t> name_indices_;
+    std::vector<double> numbers_;
+    std::unordered_map<std::uint64_t, std::uint32_t> number_indices_;
+    std::unordered_map<const void*, std::uint32_t> written_;
+};
+
+
+} // end detail
+
+
+// returns prog in the binary format
+inline std::string serialize(const program& prog)
+{
+  return detail::serializer()(prog);
+}
+
+
+// returns a program of the single definition f in the binary format
+inline std::string serialize(const function& f)
+{
+  return detail::serializer()(f);
+}
+
+
+inline void save(const program& prog, const std::string& filename)
+{
+  std::string bytes = serialize(prog);
+
+  std::ofstream os(filename, std::ios::binary);
+  os.write(bytes.data(), bytes.size());
+  if(!os)
+  {
+    throw std::runtime_error(std::string("Could not write '") + filename + "'");
+  }
+}
+
+
+class serialized_program;
+
+
+// a serialized_node is a view of an expression, function, or prototype in a serialized_program
+class serialized_node
+{
+  public:
+    inline record_kind kind() const;
+
+    // whether more than one operand refers to this node's record
+    bool is_shared() const
+    {
+      return is_record() and (word(0) & detail::shared_record_flag);
+    }
+
+    // a number's value
+    inline double value() const;
+
+    // the name of a variable, callee, loop variable, function, or prototype
+    inline symbol name() const;
+
+    // a binary operation's operator
+    char op() const
+    {
+      return static_cast<char>(word(0) >> 8);
+    }
+
+    // an expression's subexpressions, in the order they appear in the source,
+    // or a function's body
+    std::size_t num_children() const
+    {
+      switch(kind())
+      {
+        case record_kind::binary_operation: return 2;
+        case record_kind::call:             return word(2);
+        case record_kind::if_expression:    return 3;
+        case record_kind::for_expression:   return word(4) ? 4 : 3;
+        case record_kind::function:         return 1;
+        default:                            return 0;
+      }
+    }
+
+    inline serialized_node child(std::size_t i) const;
+
+    // a for_expression's step, if it has one, is its third child
+    bool has_step() const
+    {
+      return kind() == record_kind::for_expression and word(4) != 0;
+    }
+
+    // a function's or prototype's parameters
+    std::size_t num_parameters() const
+    {
+      return word(2);
+    }
+
+    inline symbol parameter(std::size_t i) const;
+
+  private:
+    friend serialized_program;
+
+    serialized_node(const serialized_program& prog, std::uint32_t operand)
+      : program_(&prog), operand_(operand)
+    {}
+
+    bool is_record() const
+    {
+      return (operand_ & detail::operand_tag_mask) == detail::record_operand;
+    }
+
+    inline std::uint32_t word(std::size_t i) const;
+
+    const serialized_program* program_;
+    std::uint32_t operand_;
+};
+
+
+// a serialized_program is a serialized program in memory
+//
+// its header and references are checked when it is loaded, so walking it or
+// converting it can't read out of bounds or loop
+class serialized_program
+{
+  public:
+    // maps a file written by save()
+    static serialized_program from_file(const std::string& filename)
+    {
+      return serialized_program(source_buffer::from_file(filename));
+    }
+
+    // the bytes must outlive the serialized_program
+    static serialized_program from_bytes(std::string_view bytes)
+    {
+      return serialized_program(source_buffer::from_view(bytes));
+    }
+
+    std::size_t num_statements() const
+    {
+      return header_.num_statements;
+    }
+
+    serialized_node statement(std::size_t i) const
+    {
+      return node_at(word_at(header_.statements_offset + 4 * i));
+    }
+
+    // converts to a program, preserving shared subtrees
+    //
+    // records are written children first, so this is a single pass over them,
+    // which keeps the records not yet referred to on a stack. validate() checked
+    // that every record's unshared children are on top of it, in order
+    program to_program() const
+    {
+      auto nodes = std::make_unique<arena>();
+      arena::scope allocate_nodes_in(*nodes);
+
+      std::vector<top_level_statement> values;
+      std::unordered_map<std::uint32_t, const void*> shared_nodes;
+
+      // the index in values of the next unshared child to take
+      std::size_t next_value = 0;
+
+      auto take = [&](serialized_node child) -> expression
+      {
+        if(!child.is_record())
+        {
+          return to_leaf(child);
+        }
+
+        if(child.is_shared())
+        {
+          return share(child.kind(), shared_nodes.at(child.operand_));
+        }
+
+        return std::get<expression>(std::move(values[next_value++]));
+      };
+
+      // stores a newly made node where its parent will find it
+      auto store = [&](serialized_node node, auto&& value)
+      {
+        using node_type = std::decay_t<decltype(value)>;
+        detail::wrapped<node_type> result(std::move(value));
+        if(node.is_shared())
+        {
+          shared_nodes.emplace(node.operand_, &result.value());
+        }
+        else
+        {
+          values.emplace_back(expression(std::move(result)));
+        }
+      };
+
+      std::uint32_t offset = records_begin();
+      while(offset < records_end())
+      {
+        serialized_node node = node_at(offset);
+
+        std::size_t first_value = values.size() - num_unshared_children(node);
+        next_value = first_value;
+
+        switch(node.kind())
+        {
+          case record_kind::binary_operation:
+          {
+            expression lhs = take(node.child(0));
+            expression rhs = take(node.child(1));
+            values.erase(values.begin() + first_value, values.end());
+            store(node, binary_operation(node.op(), std::move(lhs), std::move(rhs)));
+            break;
+          }
+
+          case record_kind::call:
+          {
+            std::vector<expression> arguments;
+            arguments.reserve(node.num_children());
+            for(std::size_t i = 0; i < node.num_children(); ++i)
+            {
+              arguments.push_back(take(node.child(i)));
+            }
+            values.erase(values.begin() + first_value, values.end());
+            store(node, call(node.name(), std::move(arguments)));
+            break;
+          }
+
+          case record_kind::if_expression:
+          {
+            expression condition = take(node.child(0));
+            expression then_expression = take(node.child(1));
+            expression else_expression = take(node.child(2));
+            values.erase(values.begin() + first_value, values.end());
+            store(node, if_expression(std::move(condition), std::move(then_expression), std::move(else_expression)));
+            break;
+          }
+
+          case record_kind::for_expression:
+          {
+            expression begin = take(node.child(0));
+            expression end = take(node.child(1));
+            std::optional<expression> step;
+            if(node.has_step())
+            {
+              step = take(node.child(2));
+            }
+            expression body = take(node.child(node.num_children() - 1));
+            values.erase(values.begin() + first_value, values.end());
+            store(node, for_expression(node.name(), std::move(begin), std::move(end), std::move(step), std::move(body)));
+            break;
+          }
+
+          case record_kind::function:
+          {
+            expression body = take(node.child(0));
+            values.erase(values.begin() + first_value, values.end());
+            values.emplace_back(function(to_prototype(node), std::move(body)));
+            break;
+          }
+
+          case record_kind::function_prototype:
+          {
+            values.emplace_back(to_prototype(node));
+            break;
+          }
+
+          default:
+          {
+            malformed();
+          }
+        }
+
+        offset += 4 * record_size(node);
+      }
+
+      // what remains are the unshared statements, in order
+      std::vector<top_level_statement> statements;
+      statements.reserve(num_statements());
+      next_value = 0;
+      for(std::size_t i = 0; i < num_statements(); ++i)
+      {
+        serialized_node s = statement(i);
+        if(s.is_record() and !s.is_shared())
+        {
+          statements.push_back(std::move(values[next_value++]));
+        }
+        else
+        {
+          statements.emplace_back(take(s));
+        }
+      }
+
+      return program(std::move(statements), std::move(nodes));
+    }
+
+  private:
+    friend serialized_node;
+
+    explicit serialized_program(source_buffer bytes)
+      : bytes_(std::move(bytes))
+    {
+      std::size_t size = bytes_.end() - bytes_.begin();
+      if(size < sizeof(header_))
+      {
+        malformed();
+      }
+
+      std::memcpy(&header_, bytes_.begin(), sizeof(header_));
+
+      if(std::memcmp(header_.magic, detail::serialized_magic, sizeof(header_.magic)) != 0)
+      {
+        throw std::runtime_error("Not a serialized program");
+      }
+
+      if(header_.version != detail::serialized_version or header_.byte_order != detail::serialized_byte_order)
+      {
+        throw std::runtime_error("Unsupported serialized program version or byte order");
+      }
+
+      if(header_.size != size or
+         header_.statements_offset != sizeof(header_) or
+         header_.num_statements > (size - sizeof(header_)) / 4 or
+         header_.numbers_offset < header_.statements_offset + 4 * header_.num_statements or
+         header_.numbers_offset > size or
+         header_.num_numbers > (size - header_.numbers_offset) / sizeof(double) or
+         header_.names_offset != header_.numbers_offset + sizeof(double) * header_.num_numbers)
+      {
+        malformed();
+      }
+
+      // intern the names once, rather than once per use
+      std::uint32_t offset = header_.names_offset;
+      names_.reserve(std::min<std::size_t>(header_.num_names, size / 4));
+      for(std::uint32_t i = 0; i < header_.num_names; ++i)
+      {
+        if(offset > size or size - offset < 4 or word_at(offset) > size - offset - 4)
+        {
+          malformed();
+        }
+
+        std::uint32_t length = word_at(offset);
+        names_.push_back(intern(std::string_view(bytes_.begin() + offset + 4, length)));
+        offset = (offset + 4 + length + 3) & ~std::uint32_t(3);
+      }
+
+      validate();
+    }
+
+    [[noreturn]] static void malformed()
+    {
+      throw std::runtime_error("Malformed serialized program");
+    }
+
+    std::uint32_t word_at(std::size_t offset) const
+    {
+      std::uint32_t result;
+      std::memcpy(&result, bytes_.begin() + offset, sizeof(result));
+      return result;
+    }
+
+    serialized_node node_at(std::uint32_t operand) const
+    {
+      return serialized_node(*this, operand);
+    }
+
+    symbol name_at(std::uint32_t index) const
+    {
+      return names_[index];
+    }
+
+    double number_at(std::uint32_t index) const
+    {
+      double result;
+      std::memcpy(&result, bytes_.begin() + header_.numbers_offset + sizeof(double) * index, sizeof(result));
+      return result;
+    }
+
+    std::uint32_t records_begin() const
+    {
+      return header_.statements_offset + 4 * header_.num_statements;
+    }
+
+    // records lie between the statement table and the pool of numbers
+    std::uint32_t records_end() const
+    {
+      return header_.numbers_offset;
+    }
+
+    // the number of words in a record
+    static std::size_t record_size(serialized_node node)
+    {
+      switch(node.kind())
+      {
+        case record_kind::binary_operation:   return 3;
+        case record_kind::call:               return 3 + std::size_t(node.word(2));
+        case record_kind::if_expression:      return 4;
+        case record_kind::for_expression:     return 6;
+        case record_kind::function:           return 4 + std::size_t(node.word(2));
+        case record_kind::function_prototype: return 3 + std::size_t(node.word(2));
+        default:                              malformed();
+      }
+    }
+
+    static std::size_t num_unshared_children(serialized_node node)
+    {
+      std::size_t result = 0;
+      for(std::size_t i = 0; i < node.num_children(); ++i)
+      {
+        serialized_node child = node.child(i);
+        result += child.is_record() and !child.is_shared();
+      }
+
+      return result;
+    }
+
+    // checks that every operand refers to a record, a name, or a number which exists,
+    // that records refer only to records before them, so no expression contains itself,
+    // that functions and prototypes appear only at the top level, and that each
+    // unshared record is referred to exactly once, by the first record after it
+    // which isn't one of its descendants, or else by the statement table
+    //
+    // records are written children first, so this is a single pass over them
+    void validate() const
+    {
+      auto check = [](bool condition)
+      {
+        if(!condition)
+        {
+          malformed();
+        }
+      };
+
+      // for each word of the records, whether a shared record begins there
+      std::vector<bool> shared_begins((records_end() - records_begin()) / 4);
+
+      // the unshared records not yet referred to
+      std::vector<std::uint32_t> unshared;
+
+      // checks the operands a record or the statement table refers to, which begin at first and may
+      // refer to records before limit, and consumes the unshared records they refer to
+      auto check_operands = [&](std::uint32_t first, std::size_t num_operands, std::uint32_t limit, bool top_level)
+      {
+        std::size_t num_unshared = 0;
+        for(std::size_t i = 0; i < num_operands; ++i)
+        {
+          std::uint32_t operand = word_at(first + 4 * i);
+          switch(operand & detail::operand_tag_mask)
+          {
+            case detail::variable_operand: check((operand >> 2) < header_.num_names); continue;
+            case detail::number_operand:   check((operand >> 2) < header_.num_numbers); continue;
+            case detail::integer_operand:  continue;
+            default:                       break;
+          }
+
+          check(operand >= records_begin() and operand < limit);
+
+          serialized_node node = node_at(operand);
+          if(node.is_shared())
+          {
+            check(shared_begins[(operand - records_begin()) / 4]);
+          }
+          else
+          {
+            ++num_unshared;
+          }
+        }
+
+        // the unshared records must be the last ones written, in order
+        check(num_unshared <= unshared.size());
+        std::size_t next = unshared.size() - num_unshared;
+        for(std::size_t i = 0; i < num_operands; ++i)
+        {
+          std::uint32_t operand = word_at(first + 4 * i);
+          if((operand & detail::operand_tag_mask) == detail::record_operand and !node_at(operand).is_shared())
+          {
+            check(operand == unshared[next++]);
+          }
+        }
+        unshared.resize(unshared.size() - num_unshared);
+
+        if(!top_level)
+        {
+          for(std::size_t i = 0; i < num_operands; ++i)
+          {
+            serialized_node node = node_at(word_at(first + 4 * i));
+            check(!node.is_record() or (node.kind() != record_kind::function and node.kind() != record_kind::function_prototype));
+          }
+        }
+      };
+
+      std::uint32_t offset = records_begin();
+      while(offset < records_end())
+      {
+        serialized_node node = node_at(offset);
+
+        auto check_size = [&](std::size_t num_words)
+        {
+          check(num_words <= (records_end() - offset) / 4);
+        };
+
+        auto check_names = [&](std::size_t first_word, std::size_t num_words)
+        {
+          for(std::size_t i = first_word; i < first_word + num_words; ++i)
+          {
+            check(node.word(i) < header_.num_names);
+          }
+        };
+
+        // check the fixed part before reading the number of arguments or parameters
+        check_size(3);
+
+        std::size_t num_words = record_size(node);
+        check_size(num_words);
+
+        switch(node.kind())
+        {
+          case record_kind::binary_operation: check_operands(offset + 4, 2, offset, false); break;
+          case record_kind::call:             check_names(1, 1); check_operands(offset + 12, node.word(2), offset, false); break;
+          case record_kind::if_expression:    check_operands(offset + 4, 3, offset, false); break;
+          case record_kind::for_expression:
+          {
+            // the step's word may be empty, so check the body, the step, and then the bounds,
+            // which consumes their unshared records in the reverse of the order they were written
+            check_names(1, 1);
+            check_operands(offset + 20, 1, offset, false);
+            if(node.has_step())
+            {
+              check_operands(offset + 16, 1, offset, false);
+            }
+            check_operands(offset + 8, 2, offset, false);
+            break;
+          }
+
+          case record_kind::function:
+          {
+            check(!node.is_shared());
+            check_names(1, 1);
+            check_names(4, node.word(2));
+            check_operands(offset + 12, 1, offset, false);
+            break;
+          }
+
+          case record_kind::function_prototype:
+          {
+            check(!node.is_shared());
+            check_names(1, 1);
+            check_names(3, node.word(2));
+            break;
+          }
+
+          default: malformed();
+        }
+
+        if(node.is_shared())
+        {
+          shared_begins[(offset - records_begin()) / 4] = true;
+        }
+        else
+        {
+          unshared.push_back(offset);
+        }
+
+        offset += 4 * num_words;
+      }
+
+      check_operands(header_.statements_offset, header_.num_statements, records_end(), true);
+      check(unshared.empty());
+    }
+
+    function_prototype to_prototype(serialized_node node) const
+    {
+      std::vector<symbol> parameters;
+      parameters.reserve(node.num_parameters());
+      for(std::size_t i = 0; i < node.num_parameters(); ++i)
+      {
+        parameters.push_back(node.parameter(i));
+      }
+
+      return function_prototype(node.name(), std::move(parameters));
+    }
+
+    static expression to_leaf(serialized_node node)
+    {
+      if(node.kind() == record_kind::variable)
+      {
+        return variable(node.name());
+      }
+
+      return number(node.value());
+    }
+
+    static expression share(record_kind kind, const void* node)
+    {
+      switch(kind)
+      {
+        case record_kind::binary_operation: return detail::wrapped<binary_operation>::share(*static_cast<const binary_operation*>(node));
+        case record_kind::call:             return detail::wrapped<call>::share(*static_cast<const call*>(node));
+        case record_kind::if_expression:    return detail::wrapped<if_expression>::share(*static_cast<const if_expression*>(node));
+        case record_kind::for_expression:   return detail::wrapped<for_expression>::share(*static_cast<const for_expression*>(node));
+        default:                            malformed();
+      }
+    }
+
+    source_buffer bytes_;
+    detail::serialized_header header_;
+    std::vector<symbol> names_;
+};
+
+
+inline record_kind serialized_node::kind() const
+{
+  switch(operand_ & detail::operand_tag_mask)
+  {
+    case detail::variable_operand: return record_kind::variable;
+    case detail::number_operand:
+    case detail::integer_operand:  return record_kind::number;
+    default:                       return static_cast<record_kind>(word(0) & 0xff);
+  }
+}
+
+
+inline std::uint32_t serialized_node::word(std::size_t i) const
+{
+  return program_->word_at(operand_ + 4 * i);
+}
+
+
+inline double serialized_node::value() const
+{
+  if((operand_ & detail::operand_tag_mask) == detail::integer_operand)
+  {
+    return static_cast<std::int32_t>(operand_) >> 2;
+  }
+
+  return program_->number_at(operand_ >> 2);
+}
+
+
+inline symbol serialized_node::name() const
+{
+  if(!is_record())
+  {
+    return program_->name_at(operand_ >> 2);
+  }
+
+  return program_->name_at(word(1));
+}
+
+
+inline serialized_node serialized_node::child(std::size_t i) const
+{
+  switch(kind())
+  {
+    case record_kind::call:           return program_->node_at(word(3 + i));
+    case record_kind::for_expression: return program_->node_at(word(i < 2 or has_step() ? 2 + i : 3 + i));
+    case record_kind::function:       return program_->node_at(word(3));
+    default:                          return program_->node_at(word(1 + i));
+  }
+}
+
+
+inline symbol serialized_node::parameter(std::size_t i) const
+{
+  return program_->name_at(word((kind() == record_kind::function ? 4 : 3) + i));
+}
+
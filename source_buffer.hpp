@@ -0,0 +1,222 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// a source_buffer presents the text of a program as a contiguous range of characters
+//
+// the text may come from an in-memory string, a borrowed view of characters
+// owned elsewhere, a memory-mapped file, or a stream
+// (e.g., stdin) which is read in chunks. a stream's buffer only holds the chunk
+// currently being lexed: when the lexer runs off the end, refill() slides the
+// unconsumed tail of the buffer to its front and appends the next chunk
+class source_buffer
+{
+  public:
+    static source_buffer from_string(std::string text)
+    {
+      source_buffer result;
+      result.storage_ = std::move(text);
+      result.reset_to_storage();
+      return result;
+    }
+
+    // the characters are not copied, so they must outlive the source_buffer
+    static source_buffer from_view(std::string_view text)
+    {
+      source_buffer result;
+      result.borrowed_ = true;
+      result.begin_ = text.data();
+      result.end_ = text.data() + text.size();
+      return result;
+    }
+
+    static source_buffer from_file(const std::string& filename)
+    {
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      if(fd == -1)
+      {
+        throw std::runtime_error(std::string("Could not open '") + filename + "'");
+      }
+
+      struct stat status;
+      if(::fstat(fd, &status) == -1)
+      {
+        ::close(fd);
+        throw std::runtime_error(std::string("Could not stat '") + filename + "'");
+      }
+
+      source_buffer result;
+
+      if(status.st_size > 0)
+      {
+        void* mapping = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(mapping != MAP_FAILED)
+        {
+          // we'll scan the file front to back
+          ::madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+
+          result.mapping_ = mapping;
+          result.mapping_size_ = status.st_size;
+          result.begin_ = static_cast<const char*>(mapping);
+          result.end_ = result.begin_ + status.st_size;
+        }
+        else
+        {
+          // couldn't map the file, so read the whole thing instead
+          result.file_descriptor_ = fd;
+          while(!result.exhausted())
+          {
+            result.read_chunk(status.st_size);
+          }
+          result.reset_to_storage();
+        }
+      }
+
+      ::close(fd);
+
+      return result;
+    }
+
+    // the stream is read lazily, so interactive input is lexed as soon as it arrives
+    static source_buffer from_stream(int file_descriptor = STDIN_FILENO, std::size_t chunk_size = 1 << 16)
+    {
+      source_buffer result;
+      result.file_descriptor_ = file_descriptor;
+      result.chunk_size_ = chunk_size;
+      result.reset_to_storage();
+      return result;
+    }
+
+    source_buffer(source_buffer&& other)
+      : source_buffer()
+    {
+      swap(other);
+    }
+
+    source_buffer& operator=(source_buffer&& other)
+    {
+      source_buffer(std::move(other)).swap(*this);
+      return *this;
+    }
+
+    ~source_buffer()
+    {
+      if(mapping_)
+      {
+        ::munmap(mapping_, mapping_size_);
+      }
+    }
+
+    const char* begin() const
+    {
+      return begin_;
+    }
+
+    const char* end() const
+    {
+      return end_;
+    }
+
+    // no more characters will arrive after end()
+    bool exhausted() const
+    {
+      return file_descriptor_ == -1;
+    }
+
+    // discards the characters before keep and reads the next chunk
+    // returns the new location of the character formerly at keep
+    const char* refill(const char* keep)
+    {
+      if(exhausted())
+      {
+        return keep;
+      }
+
+      // slide the unconsumed tail to the front of the buffer
+      storage_.erase(0, keep - storage_.data());
+
+      // read until we get at least one character or reach the end of the stream
+      while(!read_chunk(chunk_size_) and !exhausted())
+      {
+        ;
+      }
+
+      reset_to_storage();
+
+      return begin_;
+    }
+
+    void swap(source_buffer& other)
+    {
+      std::swap(storage_, other.storage_);
+      std::swap(mapping_, other.mapping_);
+      std::swap(mapping_size_, other.mapping_size_);
+      std::swap(file_descriptor_, other.file_descriptor_);
+      std::swap(chunk_size_, other.chunk_size_);
+      std::swap(borrowed_, other.borrowed_);
+
+      // pointers into storage_ must be recomputed after the swap
+      std::swap(begin_, other.begin_);
+      std::swap(end_, other.end_);
+      if(uses_storage()) reset_to_storage();
+      if(other.uses_storage()) other.reset_to_storage();
+    }
+
+  private:
+    source_buffer() = default;
+
+    bool uses_storage() const
+    {
+      return !mapping_ and !borrowed_;
+    }
+
+    void reset_to_storage()
+    {
+      begin_ = storage_.data();
+      end_ = begin_ + storage_.size();
+    }
+
+    // appends up to n characters from the stream to storage_
+    // returns false if nothing was read
+    bool read_chunk(std::size_t n)
+    {
+      std::size_t old_size = storage_.size();
+      storage_.resize(old_size + n);
+
+      ssize_t num_read = ::read(file_descriptor_, &storage_[old_size], n);
+
+      if(num_read < 0 and errno == EINTR)
+      {
+        // interrupted before anything was read; try again later
+        num_read = 0;
+      }
+      else if(num_read <= 0)
+      {
+        // EOF or error: there is nothing more to read
+        num_read = 0;
+        file_descriptor_ = -1;
+      }
+
+      storage_.resize(old_size + num_read);
+      return num_read > 0;
+    }
+
+    std::string storage_;
+    void* mapping_ = nullptr;
+    std::size_t mapping_size_ = 0;
+    int file_descriptor_ = -1;
+    std::size_t chunk_size_ = 0;
+    bool borrowed_ = false;
+    const char* begin_ = nullptr;
+    const char* end_ = nullptr;
+};
+
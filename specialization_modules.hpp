@@ -0,0 +1,44 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "generator.hpp"
+#include "jit_compiler.hpp"
+
+// the modules of specializations a generator has given a jit_compiler
+//
+// only anonymous expressions call specializations, directly or through other specializations, and
+// their modules are removed once they've run. so once the generator has forgotten a module's
+// specializations, nothing calls them anymore, and the module is removed
+class specialization_modules
+{
+  public:
+    // gives the compiler the specializations generated since the last call, which must be done before the
+    // module which calls them is added, and removes the modules whose specializations have been forgotten
+    void update(generator& gen, jit_compiler& compiler)
+    {
+      std::size_t generation = gen.specialization_generation();
+
+      auto forgotten = std::partition(modules_.begin(), modules_.end(), [&](const auto& m)
+      {
+        return m.second == generation;
+      });
+
+      for(auto m = forgotten; m != modules_.end(); ++m)
+      {
+        compiler.remove_module(m->first);
+      }
+
+      modules_.erase(forgotten, modules_.end());
+
+      if(specialization_module released = gen.release_specializations())
+      {
+        modules_.emplace_back(compiler.add_module(std::move(released.module)), released.generation);
+      }
+    }
+
+  private:
+    // each module's handle, and the generation of its specializations
+    std::vector<std::pair<jit_compiler::module_handle_t, std::size_t>> modules_;
+};
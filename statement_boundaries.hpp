@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
+#include "scan.hpp"
+
+// top-level statements are independent of each other, so a program's text may be
+// cut between them without lexing or parsing it. statements can only begin
+// with 'def' or 'extern' or follow a ';', so those are where the cuts are made
+
+
+namespace detail
+{
+
+
+// scans text from scan_begin, which must not be inside a token or comment,
+// for the first statement boundary at or after position
+inline std::size_t scan_for_statement_boundary(std::string_view text, std::size_t scan_begin, std::size_t position)
+{
+  const char* first = text.data() + scan_begin;
+  const char* last = text.data() + text.size();
+
+  auto offset = [&](const char* ptr)
+  {
+    return static_cast<std::size_t>(ptr - text.data());
+  };
+
+  while((first = find_non_space(first, last)) != last)
+  {
+    if(*first == '#')
+    {
+      first = find_line_end(first, last);
+    }
+    else if(*first == ';')
+    {
+      ++first;
+
+      if(offset(first) >= position)
+      {
+        return offset(first);
+      }
+    }
+    else if(is_alpha(*first))
+    {
+      const char* word_begin = first;
+      while(first != last and is_alpha(*first))
+      {
+        ++first;
+      }
+
+      std::optional<keyword> kw = find_keyword(std::string_view(word_begin, first - word_begin));
+      if((kw == keyword::def or kw == keyword::extern_) and offset(word_begin) >= position)
+      {
+        return offset(word_begin);
+      }
+    }
+    else
+    {
+      ++first;
+    }
+  }
+
+  return text.size();
+}
+
+
+} // end detail
+
+
+// returns the offset of the first top-level statement boundary at or after position,
+// or text.size() if there is none
+//
+// a statement boundary is either a 'def' or 'extern' keyword, which can only begin
+// a statement, or the character following a ';'
+inline std::size_t find_statement_boundary(std::string_view text, std::size_t position)
+{
+  // tokens and comments never span lines, so scanning from the start of position's
+  // line ensures we don't begin in the middle of either
+  std::size_t line_start = position;
+  while(line_start > 0 and !is_line_end(text[line_start - 1]))
+  {
+    --line_start;
+  }
+
+  return detail::scan_for_statement_boundary(text, line_start, position);
+}
+
+
+// cuts text into at most max_num_chunks pieces of roughly equal size
+// each piece begins and ends at a top-level statement boundary
+inline std::vector<std::string_view> split_at_statement_boundaries(std::string_view text, std::size_t max_num_chunks)
+{
+  std::vector<std::string_view> result;
+
+  std::size_t begin = 0;
+  for(std::size_t i = 1; i < max_num_chunks and begin < text.size(); ++i)
+  {
+    std::size_t target = std::max(begin + 1, text.size() / max_num_chunks * i);
+    std::size_t end = find_statement_boundary(text, target);
+
+    result.push_back(text.substr(begin, end - begin));
+    begin = end;
+  }
+
+  if(begin < text.size())
+  {
+    result.push_back(text.substr(begin));
+  }
+
+  return result;
+}
+
+
+// cuts text at every statement boundary
+inline std::vector<std::string_view> split_at_every_statement_boundary(std::string_view text)
+{
+  std::vector<std::string_view> result;
+
+  std::size_t begin = 0;
+  while(begin < text.size())
+  {
+    // each boundary is a safe place to resume scanning for the next
+    std::size_t end = detail::scan_for_statement_boundary(text, begin, begin + 1);
+
+    result.push_back(text.substr(begin, end - begin));
+    begin = end;
+  }
+
+  return result;
+}
+
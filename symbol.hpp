@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// a symbol is a small integer which names an interned identifier
+//
+// symbols compare equal exactly when their names do, so they may be compared,
+// hashed, and used as indices without touching the characters of their names
+class symbol
+{
+  public:
+    explicit constexpr symbol(std::uint32_t id)
+      : id_(id)
+    {}
+
+    constexpr std::uint32_t id() const
+    {
+      return id_;
+    }
+
+    inline const std::string& str() const;
+
+    constexpr bool operator==(const symbol& other) const
+    {
+      return id_ == other.id_;
+    }
+
+    constexpr bool operator!=(const symbol& other) const
+    {
+      return id_ != other.id_;
+    }
+
+    constexpr bool operator<(const symbol& other) const
+    {
+      return id_ < other.id_;
+    }
+
+  private:
+    std::uint32_t id_;
+};
+
+
+// the symbol_table maps names to symbols and back
+// it may be used from several threads at once
+//
+// names are spread across shards by hash, each with its own lock, so that
+// threads interning different names rarely wait on each other. a symbol's id
+// records its shard in its low bits and its position in the shard above them
+class symbol_table
+{
+  public:
+    static constexpr std::uint32_t num_shards = 16;
+
+    // the shard which holds a symbol's name
+    static constexpr std::uint32_t shard_of(symbol sym)
+    {
+      return sym.id() % num_shards;
+    }
+
+    // where a symbol's name is among its shard's names, which are numbered from 0 without gaps
+    static constexpr std::uint32_t position_of(symbol sym)
+    {
+      return sym.id() / num_shards;
+    }
+
+    static symbol_table& global()
+    {
+      static symbol_table result;
+      return result;
+    }
+
+    symbol intern(std::string_view name)
+    {
+      std::size_t hash = std::hash<std::string_view>()(name);
+      std::uint32_t shard_index = (hash ^ (hash >> 16)) % num_shards;
+      shard& s = shards_[shard_index];
+
+      std::lock_guard<std::mutex> lock(s.mutex);
+
+      auto found = s.ids.find(name);
+      if(found != s.ids.end())
+      {
+        return symbol(found->second);
+      }
+
+      // names is a deque, so the view we key ids with remains valid as it grows
+      std::uint32_t id = static_cast<std::uint32_t>(s.names.size()) * num_shards + shard_index;
+      s.names.emplace_back(name);
+      s.ids.emplace(s.names.back(), id);
+
+      return symbol(id);
+    }
+
+    const std::string& name(symbol sym) const
+    {
+      const shard& s = shards_[shard_of(sym)];
+      std::lock_guard<std::mutex> lock(s.mutex);
+      return s.names[position_of(sym)];
+    }
+
+    std::size_t size() const
+    {
+      std::size_t result = 0;
+      for(const shard& s : shards_)
+      {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        result += s.names.size();
+      }
+
+      return result;
+    }
+
+  private:
+    symbol_table() = default;
+
+    struct alignas(64) shard
+    {
+      mutable std::mutex mutex;
+      std::deque<std::string> names;
+      std::unordered_map<std::string_view, std::uint32_t> ids;
+    };
+
+    shard shards_[num_shards];
+};
+
+
+inline symbol intern(std::string_view name)
+{
+  return symbol_table::global().intern(name);
+}
+
+
+inline const std::string& symbol::str() const
+{
+  return symbol_table::global().name(*this);
+}
+
+
+inline std::ostream& operator<<(std::ostream& os, const symbol& s)
+{
+  return os << s.str();
+}
+
+
+namespace std
+{
+
+
+template<>
+struct hash<symbol>
+{
+  std::size_t operator()(const symbol& s) const
+  {
+    return s.id();
+  }
+};
+
+
+} // end namespace std
+
+
+// a symbol_map associates a value with each symbol
+// lookups index directly into a vector, so it is best suited to
+// small, dense sets of symbols such as the names in scope
+//
+// ids interleave the shards, so a vector indexed by id would be mostly gaps.
+// instead, each shard has a vector indexed by position, which is dense
+template<class T>
+class symbol_map
+{
+  public:
+    symbol_map(const T& default_value = T())
+      : default_value_(default_value)
+    {}
+
+    T& operator[](symbol s)
+    {
+      std::vector<T>& values = values_[symbol_table::shard_of(s)];
+      std::uint32_t position = symbol_table::position_of(s);
+
+      if(position >= values.size())
+      {
+        values.resize(position + 1, default_value_);
+      }
+
+      return values[position];
+    }
+
+    const T& operator[](symbol s) const
+    {
+      const std::vector<T>& values = values_[symbol_table::shard_of(s)];
+      std::uint32_t position = symbol_table::position_of(s);
+
+      return position < values.size() ? values[position] : default_value_;
+    }
+
+    void clear()
+    {
+      for(std::vector<T>& values : values_)
+      {
+        values.clear();
+      }
+    }
+
+  private:
+    T default_value_;
+    std::vector<T> values_[symbol_table::num_shards];
+};
+
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
+#include <optional>
 #include <vector>
 #include <string>
 #include "recursive_variant.hpp"
+#include "symbol.hpp"
 
 class number
 {
@@ -24,17 +28,17 @@ class number
 class variable
 {
   public:
-    inline variable(const std::string& name)
+    inline variable(symbol name)
       : name_(name)
     {}
 
-    inline const std::string& name() const
+    inline symbol name() const
     {
       return name_;
     }
 
   private:
-    std::string name_;
+    symbol name_;
 };
 
 class binary_operation;
@@ -46,6 +50,7 @@ class if_expression;
 class for_expression;
 
 
+// expressions are move-only: nodes are never copied once they are parsed
 using expression = recursive_variant<
   number,
   variable,
@@ -87,10 +92,10 @@ class binary_operation
 class if_expression
 {
   public:
-    if_expression(expression condition, expression then_expression, expression else_expression)
-      : condition_(condition),
-        then_expression_(then_expression),
-        else_expression_(else_expression)
+    if_expression(expression&& condition, expression&& then_expression, expression&& else_expression)
+      : condition_(std::move(condition)),
+        then_expression_(std::move(then_expression)),
+        else_expression_(std::move(else_expression))
     {}
 
     const expression& condition() const
@@ -118,19 +123,19 @@ class if_expression
 class for_expression
 {
   public:
-    for_expression(const std::string& loop_variable_name,
-                   expression begin,
-                   expression end,
-                   std::optional<expression> step,
-                   expression body)
+    for_expression(symbol loop_variable_name,
+                   expression&& begin,
+                   expression&& end,
+                   std::optional<expression>&& step,
+                   expression&& body)
       : loop_variable_name_(loop_variable_name),
-        begin_(begin),
-        end_(end),
-        step_(step),
-        body_(body)
+        begin_(std::move(begin)),
+        end_(std::move(end)),
+        step_(std::move(step)),
+        body_(std::move(body))
     {}
 
-    const std::string& loop_variable_name() const
+    symbol loop_variable_name() const
     {
       return loop_variable_name_;
     }
@@ -156,7 +161,7 @@ class for_expression
     }
 
   private:
-    std::string loop_variable_name_;
+    symbol loop_variable_name_;
     expression begin_;
     expression end_;
     std::optional<expression> step_;
@@ -167,11 +172,11 @@ class for_expression
 class call
 {
   public:
-    call(const std::string& callee_name, const std::vector<expression>& arguments)
-      : callee_name_(callee_name), arguments_(arguments)
+    call(symbol callee_name, std::vector<expression>&& arguments)
+      : callee_name_(callee_name), arguments_(std::move(arguments))
     {}
 
-    const std::string& callee_name() const
+    symbol callee_name() const
     {
       return callee_name_;
     }
@@ -182,7 +187,7 @@ class call
     }
 
   private:
-    std::string callee_name_;
+    symbol callee_name_;
     std::vector<expression> arguments_;
 };
 
@@ -190,32 +195,35 @@ class call
 class function_prototype
 {
   public:
-    function_prototype(const std::string& name, const std::vector<std::string>& parameters)
+    function_prototype(symbol name, std::vector<symbol>&& parameters)
       : name_(name),
-        parameters_(parameters)
+        parameters_(std::move(parameters))
     {}
 
-    const std::string& name() const
+    function_prototype(function_prototype&&) = default;
+    function_prototype& operator=(function_prototype&&) = default;
+
+    symbol name() const
     {
       return name_;
     }
 
-    const std::vector<std::string>& parameters() const
+    const std::vector<symbol>& parameters() const
     {
       return parameters_;
     }
 
   private:
-    std::string name_;
-    std::vector<std::string> parameters_;
+    symbol name_;
+    std::vector<symbol> parameters_;
 };
 
 
 class function
 {
   public:
-    function(const function_prototype& prototype, const expression& body)
-      : prototype_(prototype), body_(body)
+    function(function_prototype&& prototype, expression&& body)
+      : prototype_(std::move(prototype)), body_(std::move(body))
     {}
 
     const function_prototype& prototype() const
@@ -240,16 +248,35 @@ using top_level_statement = std::variant<function, function_prototype, expressio
 class program
 {
   public:
-    program(const std::vector<top_level_statement>& statements)
-      : statements_(statements)
-    {}
+    program(std::vector<top_level_statement>&& statements, std::unique_ptr<arena> nodes)
+      : statements_(std::move(statements))
+    {
+      nodes_.push_back(std::move(nodes));
+    }
 
     const std::vector<top_level_statement>& statements() const
     {
       return statements_;
     }
 
+    std::vector<top_level_statement>& statements()
+    {
+      return statements_;
+    }
+
+    // moves other's statements to the end of this program
+    void append(program&& other)
+    {
+      std::move(other.statements_.begin(), other.statements_.end(), std::back_inserter(statements_));
+      other.statements_.clear();
+
+      std::move(other.nodes_.begin(), other.nodes_.end(), std::back_inserter(nodes_));
+      other.nodes_.clear();
+    }
+
   private:
+    // own the nodes the statements refer to
+    std::vector<std::unique_ptr<arena>> nodes_;
     std::vector<top_level_statement> statements_;
 };
 
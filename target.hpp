@@ -0,0 +1,345 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include "memoization.hpp"
+
+
+// how floating point arithmetic may be rounded
+enum class float_accuracy
+{
+  // each operation is rounded as IEEE 754 says, and a*b + c is never fused
+  strict,
+
+  // a*b + c may be fused into a single, more accurate, operation
+  fused,
+
+  // anything goes: operations may be fused, reordered, and assume their operands are finite
+  fast
+};
+
+
+// how hard the optimizer and the code generator work
+enum class optimization_level
+{
+  O0,
+  O1,
+  O2,
+  O3
+};
+
+
+struct codegen_options
+{
+  // the CPU to tune for, and the features which may be used, as llc's -mcpu and -mattr
+  // an empty cpu means the host's CPU and features, a generic cpu means any CPU of the host's architecture
+  std::string cpu;
+  std::vector<std::string> features;
+
+  // the accuracy of floating point arithmetic, which the flags below may relax further
+  float_accuracy accuracy = float_accuracy::strict;
+
+  // a*b + c may be contracted into a fused multiply-add
+  bool allow_contraction = false;
+
+  // arithmetic may be reassociated, as if it were exact
+  bool allow_reassociation = false;
+
+  // operands and results may be assumed not to be NaN
+  bool no_nans = false;
+
+  // operands and results may be assumed not to be infinite
+  bool no_infs = false;
+
+  // selects the default optimization pipelines and the code generator's effort
+  optimization_level optimization = optimization_level::O2;
+
+  // textual pipelines, as opt's -passes, which replace the default function or module pipeline when not empty
+  std::string function_passes;
+  std::string module_passes;
+
+  // compile functions quickly at first, and recompile those called more than tier_up_threshold times
+  // with the pipelines and code generator effort selected above
+  bool tiered = false;
+  std::uint64_t tier_up_threshold = 1000;
+
+  // compile each module when one of its functions is first called, rather than when it is added to the jit_compiler
+  bool lazy = false;
+
+  // when a hot function is recompiled, link its callees' IR into it, so that they may be inlined
+  bool relink_hot_call_graph = false;
+
+  // lower loops written for i = a, i < n, step, with an invariant n and a constant step, to loops with an
+  // integer trip count, which LLVM can unroll and vectorize
+  bool counted_loops = true;
+
+  // give functions which only compute with doubles the attributes which let LLVM merge, delete, and hoist calls to them
+  // when one is redefined with more effects, the functions which were optimized for its old ones are generated again
+  bool infer_effects = true;
+
+  // turn a function's calls to itself in tail position into jumps back to its beginning, so that
+  // recursion which only iterates runs in constant stack space, even in the unoptimized first tier
+  bool eliminate_tail_recursion = true;
+
+  // cache the results of pure functions which call themselves, so that naive recursion, like fib's,
+  // takes time proportional to the number of distinct calls. each function caches up to memo_capacity results
+  bool memoize_recursion = false;
+  std::size_t memo_capacity = 1 << 16;
+  memo_eviction memo_eviction_policy = memo_eviction::least_recently_used;
+
+  // generate a copy of a function for each set of constant arguments it's called with, where those parameters
+  // are constants, and call the copy instead. the copies go in modules of their own, which the generator's
+  // release_specializations() returns, and which must be added to the jit_compiler before their callers
+  // only anonymous expressions' calls are specialized, since they're thrown away, while a definition's
+  // calls would keep going to copies of their callees' old definitions after those are redefined
+  bool specialize_constant_calls = false;
+
+  // tunes for the host's CPU, with IEEE arithmetic
+  static codegen_options host()
+  {
+    return codegen_options();
+  }
+
+  // generates code which runs on any CPU of the host's architecture
+  static codegen_options generic()
+  {
+    codegen_options result;
+    result.cpu = "generic";
+    return result;
+  }
+
+  static codegen_options with_accuracy(float_accuracy accuracy)
+  {
+    codegen_options result;
+    result.accuracy = accuracy;
+    return result;
+  }
+
+  static codegen_options with_optimization(optimization_level optimization)
+  {
+    codegen_options result;
+    result.optimization = optimization;
+    return result;
+  }
+
+  static codegen_options tiered_compilation()
+  {
+    codegen_options result;
+    result.tiered = true;
+    return result;
+  }
+
+  static codegen_options lazy_compilation()
+  {
+    codegen_options result;
+    result.lazy = true;
+    return result;
+  }
+
+  static codegen_options memoized_recursion()
+  {
+    codegen_options result;
+    result.memoize_recursion = true;
+    return result;
+  }
+
+  static codegen_options specialized_calls()
+  {
+    codegen_options result;
+    result.specialize_constant_calls = true;
+    return result;
+  }
+
+  // the options hot functions are recompiled with
+  codegen_options final_tier() const
+  {
+    codegen_options result = *this;
+    result.tiered = false;
+    return result;
+  }
+
+  // the flags the generator puts on floating point instructions
+  llvm::FastMathFlags fast_math_flags() const
+  {
+    llvm::FastMathFlags result;
+
+    if(accuracy == float_accuracy::fast)
+    {
+      result.setFast();
+      return result;
+    }
+
+    if(allow_contraction or accuracy == float_accuracy::fused)
+    {
+      result.setAllowContract(true);
+    }
+
+    if(allow_reassociation)
+    {
+      result.setAllowReassoc();
+    }
+
+    if(no_nans)
+    {
+      result.setNoNaNs();
+    }
+
+    if(no_infs)
+    {
+      result.setNoInfs();
+    }
+
+    return result;
+  }
+
+  // the options the TargetMachine lowers floating point instructions with
+  llvm::TargetOptions target_options() const
+  {
+    llvm::TargetOptions result;
+    llvm::FastMathFlags flags = fast_math_flags();
+
+    result.AllowFPOpFusion = accuracy == float_accuracy::fast ? llvm::FPOpFusion::Fast :
+                             flags.allowContract()            ? llvm::FPOpFusion::Standard :
+                                                                llvm::FPOpFusion::Strict;
+
+    result.UnsafeFPMath = accuracy == float_accuracy::fast;
+    result.NoNaNsFPMath = flags.noNaNs();
+    result.NoInfsFPMath = flags.noInfs();
+
+    return result;
+  }
+
+  llvm::CodeGenOpt::Level codegen_level() const
+  {
+    if(tiered)
+    {
+      // the first tier is compiled as quickly as possible
+      return llvm::CodeGenOpt::None;
+    }
+
+    switch(optimization)
+    {
+      case optimization_level::O0: return llvm::CodeGenOpt::None;
+      case optimization_level::O1: return llvm::CodeGenOpt::Less;
+      case optimization_level::O2: return llvm::CodeGenOpt::Default;
+      default:                     return llvm::CodeGenOpt::Aggressive;
+    }
+  }
+};
+
+
+// a target_context describes the machine which generated code runs on, and how code is generated for it
+//
+// building a TargetMachine is expensive, so the host's is built once, when it
+// is first asked for, and shared by every generator and jit_compiler
+class target_context
+{
+  public:
+    explicit target_context(const codegen_options& options)
+      : options_(options),
+        target_machine_(select_target(options_)),
+        data_layout_(target_machine_->createDataLayout())
+    {}
+
+    target_context(const target_context&) = delete;
+    target_context& operator=(const target_context&) = delete;
+
+    // the context for the machine we're running on
+    static target_context& host()
+    {
+      // initialized once, even when several threads ask at the same time
+      static target_context result(codegen_options::host());
+      return result;
+    }
+
+    const codegen_options& options() const
+    {
+      return options_;
+    }
+
+    llvm::TargetMachine& target_machine()
+    {
+      return *target_machine_;
+    }
+
+    const llvm::DataLayout& data_layout() const
+    {
+      return data_layout_;
+    }
+
+    std::string target_triple() const
+    {
+      return target_machine_->getTargetTriple().str();
+    }
+
+  private:
+    static llvm::TargetMachine* select_target(const codegen_options& options)
+    {
+      // these are idempotent, so it's harmless if main() has already called them
+      llvm::InitializeNativeTarget();
+      llvm::InitializeNativeTargetAsmPrinter();
+
+      std::string error;
+      llvm::EngineBuilder builder;
+      builder.setErrorStr(&error);
+      builder.setTargetOptions(options.target_options());
+      builder.setOptLevel(options.codegen_level());
+
+      if(options.cpu.empty())
+      {
+        // use whatever the host has, such as AVX2, AVX-512 and FMA
+        std::vector<std::string> features = host_features();
+        features.insert(features.end(), options.features.begin(), options.features.end());
+
+        builder.setMCPU(llvm::sys::getHostCPUName());
+        builder.setMAttrs(features);
+      }
+      else
+      {
+        builder.setMCPU(options.cpu);
+        builder.setMAttrs(options.features);
+      }
+
+      // an unknown cpu or feature gives no target at all, rather than a default one
+      llvm::TargetMachine* result = builder.selectTarget();
+      if(!result)
+      {
+        std::string cpu = options.cpu.empty() ? llvm::sys::getHostCPUName().str() : options.cpu;
+        throw std::runtime_error("Could not select a target for triple '" + llvm::sys::getProcessTriple() + "' and cpu '" + cpu + "': " + error);
+      }
+
+      return result;
+    }
+
+    static std::vector<std::string> host_features()
+    {
+      std::vector<std::string> result;
+
+      llvm::StringMap<bool> features;
+      if(llvm::sys::getHostCPUFeatures(features))
+      {
+        for(const auto& feature : features)
+        {
+          result.push_back((feature.second ? "+" : "-") + feature.first().str());
+        }
+      }
+
+      return result;
+    }
+
+    codegen_options options_;
+    std::unique_ptr<llvm::TargetMachine> target_machine_;
+    llvm::DataLayout data_layout_;
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+// first-tier code counts its calls, and when a function is called often enough,
+// asks the jit_compiler which compiled it to recompile it with the full pipeline
+//
+// the generator emits a call to tier_up_function_name, passing the address of
+// tier_up_context_name and the function's name. the jit_compiler resolves those
+// symbols to its callback and to itself
+constexpr const char* tier_up_function_name = "__kaleidoscope_tier_up";
+constexpr const char* tier_up_context_name = "__kaleidoscope_jit";
+
+
+// each first-tier function counts its calls in an internal global named after it, with this suffix
+constexpr const char* call_counter_suffix = ".calls";
+
+
+// first-tier code isn't free of side effects, since it counts its calls, so the generator only marks
+// first-tier definitions with the effects of their Kaleidoscope code, as these string attributes. the
+// jit_compiler gives a recompiled function the corresponding LLVM attributes once it has removed the counting
+constexpr const char* pure_attribute_name = "kaleidoscope-pure";
+constexpr const char* terminates_attribute_name = "kaleidoscope-terminates";
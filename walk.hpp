@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include "syntax.hpp"
+#include "overloaded.hpp"
+
+// calls f with each subexpression of root, including root itself, in no particular order
+// subexpressions are walked with an explicit stack, so arbitrarily deep expressions
+// don't exhaust the native stack
+template<class Function>
+void for_each_subexpression(const expression& root, Function f)
+{
+  std::vector<const expression*> stack{&root};
+
+  while(!stack.empty())
+  {
+    const expression& e = *stack.back();
+    stack.pop_back();
+
+    f(e);
+
+    // push e's children
+    visit(overloaded(
+      [&](const binary_operation& node)
+      {
+        stack.push_back(&node.lhs());
+        stack.push_back(&node.rhs());
+      },
+      [&](const call& node)
+      {
+        for(const expression& argument : node.arguments())
+        {
+          stack.push_back(&argument);
+        }
+      },
+      [&](const if_expression& node)
+      {
+        stack.push_back(&node.condition());
+        stack.push_back(&node.then_expression());
+        stack.push_back(&node.else_expression());
+      },
+      [&](const for_expression& node)
+      {
+        stack.push_back(&node.begin());
+        stack.push_back(&node.end());
+        if(node.step())
+        {
+          stack.push_back(&*node.step());
+        }
+        stack.push_back(&node.body());
+      },
+      [](const auto&)
+      {
+        // numbers and variables have no children
+      }),
+      e
+    );
+  }
+}
+
+
+// calls f with the name of each function called by root
+template<class Function>
+void for_each_callee(const expression& root, Function f)
+{
+  for_each_subexpression(root, [&](const expression& e)
+  {
+    if(const call* c = ::get_if<call>(&e))
+    {
+      f(c->callee_name());
+    }
+  });
+}
+